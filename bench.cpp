@@ -0,0 +1,465 @@
+// Benchmarks for the order book.
+//
+// Build with `make bench` and run `./bench [--json] [orders] [rounds]`.
+// Everything runs in-process: commands go straight to InstrumentNew and
+// OrderBookNew, and output is discarded (the clocks still tick), so the
+// numbers cover matching and bookkeeping only. The benchmarks and the engine
+// sources they link are built without the debug flags.
+//
+// --json prints the results as one JSON object, to diff across commits.
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "order_book.hpp"
+#include "order_queue.hpp"
+
+// Global allocation accounting, so we can report bytes and allocations per
+// operation without an external profiler.
+static std::atomic<size_t> live_bytes = 0;
+static std::atomic<size_t> allocations = 0;
+
+void *operator new(size_t size) {
+  auto ptr = malloc(size ? size : 1);
+  if (!ptr) {
+    throw std::bad_alloc{};
+  }
+  live_bytes.fetch_add(malloc_usable_size(ptr), std::memory_order_relaxed);
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return ptr;
+}
+
+// Kept out of line: once inlined next to operator new, GCC takes the free()
+// for a mismatched deallocation.
+[[gnu::noinline]] static void release(void *ptr) {
+  if (ptr) {
+    live_bytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+    free(ptr);
+  }
+}
+
+void operator delete(void *ptr) noexcept { release(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { release(ptr); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Request {
+  uint32_t id;
+  uint32_t price;
+  uint32_t count;
+};
+
+// One benchmark's totals over all its rounds.
+struct Result {
+  std::string name;
+  double ops = 0;
+  double seconds = 0;
+  double allocations = 0;
+  double bytes = 0;
+
+  double nsPerOp() const { return seconds * 1e9 / ops; }
+  double opsPerSecond() const { return ops / seconds; }
+  double allocationsPerOp() const { return allocations / ops; }
+  double bytesPerOp() const { return bytes / ops; }
+};
+
+// Measures one timed section: elapsed time, allocations and the change in
+// live heap bytes.
+struct Measurement {
+  Result &result;
+  double ops;
+  size_t allocations_before = allocations.load();
+  size_t bytes_before = live_bytes.load();
+  Clock::time_point start = Clock::now();
+
+  Measurement(Result &_result, size_t _ops)
+      : result{_result}, ops{static_cast<double>(_ops)} {}
+
+  ~Measurement() {
+    result.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+    result.ops += ops;
+    result.allocations +=
+        static_cast<double>(allocations.load() - allocations_before);
+    result.bytes += static_cast<double>(live_bytes.load()) -
+                    static_cast<double>(bytes_before);
+  }
+};
+
+// The resting-order layout before the OrderPool: one std::list node per
+// order and the per-side index storing list iterators.
+struct ListBook {
+  struct Order {
+    uint32_t id;
+    uint32_t price;
+    uint32_t count;
+    uint32_t execution_id;
+  };
+  struct Limit {
+    std::list<Order> orders;
+  };
+
+  std::map<uint32_t, std::unique_ptr<Limit>> limits;
+  std::unordered_map<uint32_t, std::list<Order>::iterator> orders;
+
+  void add(const Request &request) {
+    auto &limit = limits[request.price];
+    if (!limit) {
+      limit = std::make_unique<Limit>();
+    }
+    limit->orders.push_back({request.id, request.price, request.count, 1});
+    orders[request.id] = prev(limit->orders.end());
+  }
+
+  void cancel(uint32_t id) {
+    auto it = orders.find(id);
+    auto order_it = it->second;
+    auto limit_it = limits.find(order_it->price);
+    limit_it->second->orders.erase(order_it);
+    orders.erase(it);
+    if (limit_it->second->orders.empty()) {
+      limits.erase(limit_it);
+    }
+  }
+};
+
+// The current layout: intrusive FIFOs over a slab-backed OrderPool.
+struct PoolBook {
+  struct Limit {
+    OrderQueue orders;
+  };
+
+  OrderPool pool;
+  std::map<uint32_t, std::unique_ptr<Limit>> limits;
+  std::unordered_map<uint32_t, OrderHandle> orders;
+
+  void add(const Request &request) {
+    auto &limit = limits[request.price];
+    if (!limit) {
+      limit = std::make_unique<Limit>();
+    }
+    orders[request.id] = limit->orders.pushBack(
+        pool, {request.id, request.price, request.count, 1, NULL_HANDLE,
+               NULL_HANDLE, nullptr});
+  }
+
+  void cancel(uint32_t id) {
+    auto it = orders.find(id);
+    auto handle = it->second;
+    auto limit_it = limits.find(pool[handle].price);
+    limit_it->second->orders.erase(pool, handle);
+    orders.erase(it);
+    if (limit_it->second->orders.empty()) {
+      limits.erase(limit_it);
+    }
+  }
+};
+
+template <typename Book>
+void runAddCancel(const std::vector<Request> &adds,
+                  const std::vector<uint32_t> &cancels, int rounds,
+                  Result &add_result, Result &cancel_result) {
+  for (int round = 0; round < rounds; ++round) {
+    Book book;
+    // Reserve up front so rehashing is not counted against either layout.
+    book.orders.reserve(adds.size());
+    {
+      Measurement measure{add_result, adds.size()};
+      for (auto &request : adds) {
+        book.add(request);
+      }
+    }
+    Measurement measure{cancel_result, cancels.size()};
+    for (auto id : cancels) {
+      book.cancel(id);
+    }
+  }
+}
+
+// Orders resting on 64 levels around a mid price, cancelled in random order
+// so the FIFOs are unlinked from the middle as well as the ends.
+void benchLayouts(size_t order_count, int rounds, std::vector<Result> &results) {
+  std::mt19937 rng{42};
+  std::uniform_int_distribution<uint32_t> price_dist{968, 1031};
+  std::uniform_int_distribution<uint32_t> count_dist{1, 100};
+  std::vector<Request> adds(order_count);
+  for (uint32_t i = 0; i < order_count; ++i) {
+    adds[i] = {i, price_dist(rng), count_dist(rng)};
+  }
+  std::vector<uint32_t> cancels(order_count);
+  std::iota(cancels.begin(), cancels.end(), 0);
+  std::shuffle(cancels.begin(), cancels.end(), rng);
+
+  Result list_add{"layout/list-add"}, list_cancel{"layout/list-cancel"};
+  runAddCancel<ListBook>(adds, cancels, rounds, list_add, list_cancel);
+  Result pool_add{"layout/pool-add"}, pool_cancel{"layout/pool-cancel"};
+  runAddCancel<PoolBook>(adds, cancels, rounds, pool_add, pool_cancel);
+  results.insert(results.end(), {list_add, list_cancel, pool_add, pool_cancel});
+}
+
+// Buys resting on 64 levels below any sell, so nothing matches.
+void benchPassiveAdds(size_t order_count, int rounds,
+                      std::vector<Result> &results) {
+  std::mt19937 rng{1};
+  std::uniform_int_distribution<uint32_t> price_dist{968, 1031};
+  std::vector<Request> adds(order_count);
+  for (uint32_t i = 0; i < order_count; ++i) {
+    adds[i] = {i, price_dist(rng), 10};
+  }
+
+  Result result{"instrument/passive-add"};
+  for (int round = 0; round < rounds; ++round) {
+    auto book = std::make_unique<OrderBookNew>();
+    auto &instrument = book->ensureInstrumentExists("BENCH");
+    Measurement measure{result, adds.size()};
+    for (auto &add : adds) {
+      instrument.handleBuyOrder(add.id, add.price, add.count);
+    }
+  }
+  results.push_back(result);
+}
+
+// Sells of one unit resting on 256 levels, then buys that each take out the
+// best SWEEP_DEPTH of them, crossing several levels per buy.
+void benchSweeps(size_t order_count, int rounds, std::vector<Result> &results) {
+  constexpr uint32_t SWEEP_DEPTH = 64;
+  auto sweeps = static_cast<uint32_t>(order_count / SWEEP_DEPTH);
+
+  Result result{"instrument/sweep-64"};
+  for (int round = 0; round < rounds; ++round) {
+    auto book = std::make_unique<OrderBookNew>();
+    auto &instrument = book->ensureInstrumentExists("BENCH");
+    for (uint32_t i = 0; i < sweeps * SWEEP_DEPTH; ++i) {
+      instrument.handleSellOrder(i, 1000 + i % 256, 1);
+    }
+    auto id = sweeps * SWEEP_DEPTH;
+    Measurement measure{result, sweeps};
+    for (uint32_t i = 0; i < sweeps; ++i) {
+      instrument.handleBuyOrder(id++, 2000, SWEEP_DEPTH);
+    }
+  }
+  results.push_back(result);
+}
+
+// A window of resting orders on both sides; every step adds an order and
+// cancels a random one from the window.
+void benchCancelChurn(size_t order_count, int rounds,
+                      std::vector<Result> &results) {
+  constexpr size_t WINDOW = 1024;
+  std::mt19937 rng{2};
+  std::uniform_int_distribution<uint32_t> offset_dist{1, 32};
+  std::vector<Request> adds(order_count);
+  std::vector<uint32_t> cancels(order_count);
+  std::vector<uint32_t> window;
+  for (uint32_t i = 0; i < order_count; ++i) {
+    // Buys below 1000 and sells above it, so nothing crosses.
+    auto offset = offset_dist(rng);
+    adds[i] = {i, i % 2 ? 1000 + offset : 1000 - offset, 10};
+    window.push_back(i);
+    if (window.size() > WINDOW) {
+      auto victim = rng() % window.size();
+      cancels[i] = window[victim];
+      window[victim] = window.back();
+      window.pop_back();
+    } else {
+      cancels[i] = UINT32_MAX; // rejected: no such order
+    }
+  }
+
+  Result result{"instrument/cancel-churn"};
+  for (int round = 0; round < rounds; ++round) {
+    auto book = std::make_unique<OrderBookNew>();
+    auto &instrument = book->ensureInstrumentExists("BENCH");
+    Measurement measure{result, 2 * order_count};
+    for (size_t i = 0; i < order_count; ++i) {
+      auto &add = adds[i];
+      if (add.id % 2) {
+        instrument.handleSellOrder(add.id, add.price, add.count);
+      } else {
+        instrument.handleBuyOrder(add.id, add.price, add.count);
+      }
+      if (auto location = book->orders.find(cancels[i])) {
+        instrument.handleCancelOrder(cancels[i], *location);
+      } else {
+        book->rejectCancel(cancels[i]);
+      }
+    }
+  }
+  results.push_back(result);
+}
+
+// Threads sending a mix of passive orders, crossing orders and cancels of
+// their own orders for four shared instruments through OrderBookNew, either
+// through its locks or, if combining, through the instruments' flat
+// combiners as in EngineMode::COMBINING.
+void benchContention(size_t order_count, int rounds, unsigned threads,
+                     bool combining, std::vector<Result> &results) {
+  constexpr const char *SYMBOLS[] = {"AAPL", "GOOG", "MSFT", "NVDA"};
+  struct Command {
+    char type;
+    uint32_t id;
+    uint32_t price;
+    const char *symbol;
+  };
+
+  auto per_thread = order_count / threads;
+  std::vector<std::vector<Command>> streams(threads);
+  for (unsigned t = 0; t < threads; ++t) {
+    std::mt19937 rng{100 + t};
+    std::vector<uint32_t> own;
+    for (size_t i = 0; i < per_thread; ++i) {
+      auto roll = rng() % 10;
+      if (roll < 2 && !own.empty()) {
+        auto victim = rng() % own.size();
+        streams[t].push_back({'C', own[victim], 0, nullptr});
+        own[victim] = own.back();
+        own.pop_back();
+        continue;
+      }
+      auto id = static_cast<uint32_t>(t * per_thread + i);
+      bool sell = rng() % 2;
+      // Passive orders rest up to 16 ticks away from 1000; crossing ones
+      // reach 8 ticks through it.
+      auto offset = static_cast<uint32_t>(rng() % 16 + 1);
+      uint32_t price;
+      if (roll < 4) {
+        price = sell ? 1000 - offset / 2 : 1000 + offset / 2;
+      } else {
+        price = sell ? 1000 + offset : 1000 - offset;
+      }
+      streams[t].push_back(
+          {sell ? 'S' : 'B', id, price, SYMBOLS[rng() % std::size(SYMBOLS)]});
+      own.push_back(id);
+    }
+  }
+
+  Result result{(combining ? "book/combining-" : "book/contention-") +
+                std::to_string(threads)};
+  for (int round = 0; round < rounds; ++round) {
+    auto book = std::make_unique<OrderBookNew>();
+    for (auto *symbol : SYMBOLS) {
+      book->ensureInstrumentExists(symbol);
+    }
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t] {
+        while (!go.load(std::memory_order_acquire)) {
+        }
+        InstrumentCache cache;
+        for (auto &command : streams[t]) {
+          if (combining) {
+            ClientCommand input{};
+            input.type = command.type == 'B'   ? input_buy
+                         : command.type == 'S' ? input_sell
+                                               : input_cancel;
+            input.order_id = command.id;
+            input.price = command.price;
+            input.count = 10;
+            if (command.symbol) {
+              strcpy(input.instrument, command.symbol);
+            }
+            book->combineCommand(input, cache);
+            continue;
+          }
+          switch (command.type) {
+          case 'B':
+            book->processBuyOrder(command.id, command.price, 10, command.symbol);
+            break;
+          case 'S':
+            book->processSellOrder(command.id, command.price, 10,
+                                   command.symbol);
+            break;
+          default:
+            book->processCancelOrder(command.id);
+            break;
+          }
+        }
+      });
+    }
+    Measurement measure{result, per_thread * threads};
+    go.store(true, std::memory_order_release);
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+  results.push_back(result);
+}
+
+void printTable(size_t order_count, int rounds,
+                const std::vector<Result> &results) {
+  printf("orders: %zu, rounds: %d\n", order_count, rounds);
+  printf("%-26s %10s %12s %10s %10s\n", "benchmark", "ns/op", "ops/s",
+         "allocs/op", "bytes/op");
+  for (auto &result : results) {
+    printf("%-26s %10.1f %12.0f %10.3f %10.1f\n", result.name.c_str(),
+           result.nsPerOp(), result.opsPerSecond(), result.allocationsPerOp(),
+           result.bytesPerOp());
+  }
+}
+
+void printJson(size_t order_count, int rounds,
+               const std::vector<Result> &results) {
+  printf("{\n  \"orders\": %zu,\n  \"rounds\": %d,\n  \"results\": [\n",
+         order_count, rounds);
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto &result = results[i];
+    printf("    {\"name\": \"%s\", \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, "
+           "\"allocs_per_op\": %.4f, \"bytes_per_op\": %.2f}%s\n",
+           result.name.c_str(), result.nsPerOp(), result.opsPerSecond(),
+           result.allocationsPerOp(), result.bytesPerOp(),
+           i + 1 < results.size() ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  bool json = argc > 1 && strcmp(argv[1], "--json") == 0;
+  if (json) {
+    --argc;
+    ++argv;
+  }
+  size_t order_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1u << 20;
+  int rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+  Output::configure(OutputMode::Discard);
+
+  std::vector<Result> results;
+  benchLayouts(order_count, rounds, results);
+  benchPassiveAdds(order_count, rounds, results);
+  benchSweeps(order_count, rounds, results);
+  benchCancelChurn(order_count, rounds, results);
+  // At least up to 4 threads, so the set of results is the same everywhere.
+  auto max_threads = std::max(4u, std::thread::hardware_concurrency());
+  for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+    benchContention(order_count, rounds, threads, false, results);
+    benchContention(order_count, rounds, threads, true, results);
+  }
+
+  if (json) {
+    printJson(order_count, rounds, results);
+  } else {
+    printTable(order_count, rounds, results);
+  }
+  return 0;
+}
@@ -0,0 +1,63 @@
+// Record layout of OutputMode::Binary.
+//
+// The stream is a plain sequence of records, without header or separators.
+// Each record stands for one text output line and starts with the line's kind
+// character; for cancels and amends that were rejected it is lowercased
+// instead of carrying a flag. The fields after it are unsigned LEB128
+// varints:
+//
+//   kind      fields after the kind byte
+//   B, S      id, symbol, price, count, time
+//   E         resting id, new id, execution id, price, count, time
+//   X, x      id, time
+//   M, m      id, price, count, time
+//   K         id, count, time
+//
+// time is the zigzag-encoded difference to the timestamp of the previous
+// record, or to 0 for the first one. symbol is an index into the symbols the
+// stream has named so far; an index one past the last of them names a new
+// symbol, whose length byte and characters follow it. A stream therefore has
+// to be decoded from its start. A typical record takes 8 to 14 bytes, against
+// 30 to 45 for its text line. `./decode` turns a stream back into the text
+// format.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Longest record: a B or S naming a new 8-character symbol, with four 32-bit
+// fields of up to 5 bytes each and a time of up to 10.
+constexpr size_t MAX_BINARY_RECORD = 1 + 4 * 5 + 1 + 8 + 10;
+
+inline char *putVarint(char *out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<char>(value);
+  return out;
+}
+
+// Reads a varint from [in, end) and advances in past it. Returns false if the
+// input ends inside it, or it is longer than any uint64_t.
+inline bool getVarint(const char *&in, const char *end, uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; in != end && shift < 64; shift += 7) {
+    auto byte = static_cast<uint8_t>(*in++);
+    value |= uint64_t{byte & 0x7fu} << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
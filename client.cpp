@@ -12,16 +12,39 @@
 
 #include <atomic>
 
+#include "client_command.hpp"
 #include "io.hpp"
 
-#define INPUT_CANCEL_ORDER 'C'
-#define INPUT_BUY_ORDER 'B'
-#define INPUT_SELL_ORDER 'S'
-
 static char* line_buffer;
 static size_t line_buffer_size = 0;
 static std::atomic<bool> main_is_exiting = 0;
 
+// Commands waiting to be sent in one frame; see FrameHeader.
+static char frame[MAX_FRAME_BYTES];
+static uint16_t frame_count = 0;
+
+static bool send_frame(FILE* client)
+{
+	if(frame_count == 0)
+		return true;
+
+	FrameHeader header { FrameHeader::MAGIC, FrameHeader::VERSION, frame_count };
+	memcpy(frame, &header, sizeof(header));
+	size_t size = sizeof(header) + frame_count * sizeof(ClientCommand);
+	frame_count = 0;
+	return fwrite(frame, 1, size, client) == size;
+}
+
+// Whether more input can be read without blocking, so the frame can wait
+// for it.
+static bool input_ready()
+{
+	struct pollfd pfd {};
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 0) == 1;
+}
+
 static void* poll_thread(void* fdptr)
 {
 	struct pollfd pfd {};
@@ -52,7 +75,15 @@ int main(int argc, char* argv[])
 {
 	if(argc < 2)
 	{
-		fprintf(stderr, "Usage: %s <path of socket to connect to> < <input>\n", argv[0]);
+		fprintf(stderr, "Usage: %s <path of socket to connect to> [commands per frame] < <input>\n", argv[0]);
+		return 1;
+	}
+
+	// Commands are sent one by one unless a frame size is given.
+	unsigned long frame_size = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+	if(frame_size > FrameHeader::MAX_COMMANDS)
+	{
+		fprintf(stderr, "At most %u commands per frame\n", FrameHeader::MAX_COMMANDS);
 		return 1;
 	}
 
@@ -88,42 +119,52 @@ int main(int argc, char* argv[])
 	{
 		ClientCommand input {};
 
+		// A partial frame goes out once the input stalls, so interactive use
+		// still gets its answers.
+		if(frame_count && !input_ready() && !send_frame(client))
+		{
+			fprintf(stderr, "Failed to write command\n");
+			return 1;
+		}
+
 		ssize_t line_length = getline(&line_buffer, &line_buffer_size, stdin);
 		if(line_length == -1)
 			break;
 
-		switch(line_buffer[0])
+		switch(parseClientCommand(line_buffer, input))
 		{
-			case '#':
-			case '\n': continue;
-			case INPUT_CANCEL_ORDER:
-				input.type = input_cancel;
-				if(sscanf(line_buffer + 1, " %u", &input.order_id) != 1)
-				{
-					fprintf(stderr, "Invalid cancel order: %s\n", line_buffer);
-					return 1;
-				}
-				break;
-			case INPUT_BUY_ORDER: input.type = input_buy; goto new_order;
-			case INPUT_SELL_ORDER:
-				input.type = input_sell;
-			new_order:
-				if(sscanf(line_buffer + 1, " %u %8s %u %u", &input.order_id, input.instrument, &input.price, &input.count) != 4)
-				{
-					fprintf(stderr, "Invalid new order: %s\n", line_buffer);
-					return 1;
-				}
-				break;
-			default: fprintf(stderr, "Invalid command '%c'\n", line_buffer[0]); return 1;
+			case ParseResult::Command: break;
+			case ParseResult::Skip: continue;
+			case ParseResult::InvalidCancel: fprintf(stderr, "Invalid cancel order: %s\n", line_buffer); return 1;
+			case ParseResult::InvalidNew: fprintf(stderr, "Invalid new order: %s\n", line_buffer); return 1;
+			case ParseResult::InvalidAmend: fprintf(stderr, "Invalid amend order: %s\n", line_buffer); return 1;
+			case ParseResult::InvalidCommand: fprintf(stderr, "Invalid command '%c'\n", line_buffer[0]); return 1;
 		}
 
-		if(fwrite(&input, 1, sizeof(input), client) != sizeof(input))
+		if(frame_size)
+		{
+			memcpy(frame + sizeof(FrameHeader) + frame_count++ * sizeof(ClientCommand), &input, sizeof(input));
+			if(frame_count < frame_size)
+				continue;
+			if(!send_frame(client))
+			{
+				fprintf(stderr, "Failed to write command\n");
+				return 1;
+			}
+		}
+		else if(fwrite(&input, 1, sizeof(input), client) != sizeof(input))
 		{
 			fprintf(stderr, "Failed to write command\n");
 			return 1;
 		}
 	}
 
+	if(!send_frame(client))
+	{
+		fprintf(stderr, "Failed to write command\n");
+		return 1;
+	}
+
 	main_is_exiting = 1;
 	fclose(client);
 
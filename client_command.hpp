@@ -0,0 +1,95 @@
+#pragma once
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "io.hpp"
+
+// The text form of client commands, shared by the client and the load
+// generator:
+//
+//   B <id> <instrument> <price> <count> [IOC|FOK]
+//   S <id> <instrument> <price> <count> [IOC|FOK]
+//   C <id>
+//   A <id> <price> <count>
+//
+// Blank lines and lines starting with '#' are skipped.
+enum class ParseResult
+{
+	Command,
+	Skip,
+	InvalidCancel,
+	InvalidNew,
+	InvalidAmend,
+	InvalidCommand
+};
+
+inline ParseResult parseClientCommand(const char* line, ClientCommand& command)
+{
+	command = {};
+	switch(line[0])
+	{
+		case '\0':
+		case '\n':
+		case '#': return ParseResult::Skip;
+		case 'C':
+			command.type = input_cancel;
+			return sscanf(line + 1, " %u", &command.order_id) == 1 ? ParseResult::Command : ParseResult::InvalidCancel;
+		case 'A':
+			command.type = input_amend;
+			return sscanf(line + 1, " %u %u %u", &command.order_id, &command.price, &command.count) == 3
+			           ? ParseResult::Command
+			           : ParseResult::InvalidAmend;
+		case 'B': command.type = input_buy; break;
+		case 'S': command.type = input_sell; break;
+		default: return ParseResult::InvalidCommand;
+	}
+	char tif[4] = "";
+	switch(sscanf(line + 1, " %u %8s %u %u %3s", &command.order_id, command.instrument, &command.price, &command.count, tif))
+	{
+		case 4: return ParseResult::Command;
+		case 5: break;
+		default: return ParseResult::InvalidNew;
+	}
+	bool is_sell = command.type == input_sell;
+	if(strcmp(tif, "IOC") == 0)
+		command.type = is_sell ? input_sell_ioc : input_buy_ioc;
+	else if(strcmp(tif, "FOK") == 0)
+		command.type = is_sell ? input_sell_fok : input_buy_fok;
+	else
+		return ParseResult::InvalidNew;
+	return ParseResult::Command;
+}
+
+// Parses the thread prefix of a testcase line, "0", "0,2" or "1-3,5", into
+// thread ids.
+inline bool parseThreadSpec(const std::string& spec, std::vector<unsigned>& threads)
+{
+	std::stringstream parts{spec};
+	std::string part;
+	while(std::getline(parts, part, ','))
+	{
+		unsigned first, last;
+		auto dash = part.find('-');
+		auto* begin = part.data();
+		auto* end = begin + part.size();
+		if(dash == std::string::npos)
+		{
+			if(std::from_chars(begin, end, first).ptr != end)
+				return false;
+			last = first;
+		}
+		else if(std::from_chars(begin, begin + dash, first).ptr != begin + dash ||
+		        std::from_chars(begin + dash + 1, end, last).ptr != end)
+		{
+			return false;
+		}
+		for(auto thread = first; thread <= last; ++thread)
+			threads.push_back(thread);
+	}
+	return true;
+}
@@ -0,0 +1,144 @@
+// Runtime configuration of the engine.
+//
+// main() only takes the socket path, so everything else is read from
+// environment variables. Unset or unparsable variables keep the defaults.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "io.hpp"
+#include "shm_transport.hpp"
+
+enum class EngineMode {
+  // Every connection thread matches directly inside InstrumentNew.
+  THREADED,
+  // Instruments are partitioned across single-writer matching workers.
+  SHARDED,
+  // Connection threads hand their commands to a per-instrument flat
+  // combiner (see flat_combining.hpp), which one of them runs at a time.
+  COMBINING,
+};
+
+struct EngineConfig {
+  EngineMode mode = EngineMode::THREADED;
+
+  // ENGINE_WORKERS: number of matching workers in SHARDED mode.
+  unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+  // ENGINE_PIN_WORKERS: pin each worker to its own CPU.
+  bool pin_workers = true;
+  // ENGINE_WORKER_QUEUE: capacity of each worker's command ring, rounded up
+  // to a power of two.
+  unsigned worker_queue = 1u << 16;
+
+  // ENGINE_IO_THREADS: number of epoll reactor threads serving all client
+  // connections. 0 keeps one blocking thread per connection.
+  unsigned io_threads = 0;
+  // ENGINE_IO_URING: accept and read every connection through one io_uring
+  // on the main thread. Falls back to the settings above if the kernel
+  // can't provide it.
+  bool io_uring = false;
+  // ENGINE_LISTEN_BACKLOG: backlog of the listening socket.
+  int listen_backlog = 8;
+  // ENGINE_SHM_SOCKET: path of a second socket on which clients hand over
+  // shared-memory regions; see shm_transport.hpp. Empty to not offer it.
+  std::string shm_socket;
+  // ENGINE_SHM_SPINS: how often an idle shared-memory ring is polled before
+  // the engine sleeps on it. 0 sleeps at once.
+  unsigned shm_spins = defaultShmSpins();
+
+  // ENGINE_OUTPUT: "async" (default), "sync", "discard" or "binary".
+  OutputMode output = OutputMode::Async;
+  // ENGINE_OUTPUT_PATH: file or FIFO the output goes to instead of stdout.
+  std::string output_path;
+
+  // ENGINE_SNAPSHOT: snapshot file. If set, the book is restored from it at
+  // startup when it exists, and saved to it on SIGUSR2.
+  std::string snapshot;
+  // ENGINE_SNAPSHOT_INTERVAL_MS: also save the snapshot this often; 0 for
+  // only on SIGUSR2.
+  unsigned snapshot_interval_ms = 0;
+
+  // ENGINE_JOURNAL: journal file every accepted command is appended to.
+  std::string journal;
+  // ENGINE_JOURNAL_BATCH_BYTES / ENGINE_JOURNAL_INTERVAL_US: the journal
+  // commits once this much is pending, or once the oldest pending command
+  // is this old (0 for as soon as the writer catches up).
+  unsigned journal_batch_bytes = 1u << 20;
+  unsigned journal_interval_us = 1000;
+  // ENGINE_REPLAY: journal to run through the book at startup, before any
+  // connection is served. Its output is discarded unless ENGINE_REPLAY_PRINT
+  // is 1. After restoring ENGINE_SNAPSHOT, only the commands the snapshot
+  // does not hold yet are run, which needs a snapshot saved while writing
+  // this journal.
+  std::string replay;
+  bool replay_print = false;
+
+  static unsigned envUnsigned(const char *name, unsigned fallback) {
+    auto *value = getenv(name);
+    if (!value || !*value) {
+      return fallback;
+    }
+    char *end;
+    auto parsed = strtoul(value, &end, 10);
+    return *end ? fallback : static_cast<unsigned>(parsed);
+  }
+
+  static EngineConfig fromEnvironment() {
+    EngineConfig config;
+    if (auto *mode = getenv("ENGINE_MODE")) {
+      if (std::string_view{mode} == "sharded") {
+        config.mode = EngineMode::SHARDED;
+      } else if (std::string_view{mode} == "combining") {
+        config.mode = EngineMode::COMBINING;
+      }
+    }
+    if (auto *output = getenv("ENGINE_OUTPUT")) {
+      if (std::string_view{output} == "sync") {
+        config.output = OutputMode::Sync;
+      } else if (std::string_view{output} == "discard") {
+        config.output = OutputMode::Discard;
+      } else if (std::string_view{output} == "binary") {
+        config.output = OutputMode::Binary;
+      }
+    }
+    if (auto *output_path = getenv("ENGINE_OUTPUT_PATH")) {
+      config.output_path = output_path;
+    }
+    if (auto *snapshot = getenv("ENGINE_SNAPSHOT")) {
+      config.snapshot = snapshot;
+    }
+    config.snapshot_interval_ms =
+        envUnsigned("ENGINE_SNAPSHOT_INTERVAL_MS", config.snapshot_interval_ms);
+    if (auto *journal = getenv("ENGINE_JOURNAL")) {
+      config.journal = journal;
+    }
+    config.journal_batch_bytes =
+        envUnsigned("ENGINE_JOURNAL_BATCH_BYTES", config.journal_batch_bytes);
+    config.journal_interval_us =
+        envUnsigned("ENGINE_JOURNAL_INTERVAL_US", config.journal_interval_us);
+    if (auto *replay = getenv("ENGINE_REPLAY")) {
+      config.replay = replay;
+    }
+    config.replay_print = envUnsigned("ENGINE_REPLAY_PRINT", 0) != 0;
+    config.io_threads = envUnsigned("ENGINE_IO_THREADS", config.io_threads);
+    config.io_uring = envUnsigned("ENGINE_IO_URING", 0) != 0;
+    config.listen_backlog = static_cast<int>(
+        envUnsigned("ENGINE_LISTEN_BACKLOG",
+                    static_cast<unsigned>(config.listen_backlog)));
+    if (auto *shm_socket = getenv("ENGINE_SHM_SOCKET")) {
+      config.shm_socket = shm_socket;
+    }
+    config.shm_spins = envUnsigned("ENGINE_SHM_SPINS", config.shm_spins);
+    config.workers = std::max(1u, envUnsigned("ENGINE_WORKERS", config.workers));
+    config.pin_workers = envUnsigned("ENGINE_PIN_WORKERS", 1) != 0;
+    config.worker_queue =
+        std::max(2u, envUnsigned("ENGINE_WORKER_QUEUE", config.worker_queue));
+    return config;
+  }
+};
@@ -0,0 +1,206 @@
+// Turns the engine's binary output back into its text output.
+//
+//   make decode
+//   ENGINE_OUTPUT=binary ./engine socket | ./decode
+//   ./decode [file]
+//
+// Reads records as laid out in binary_output.hpp from the file, or from
+// stdin if none is given, and writes the lines OutputMode::Async would have
+// written for the same events to stdout. An invalid record or a record cut
+// off at the end of the input is reported and ends the decoding with status
+// 1.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "binary_output.hpp"
+
+namespace {
+
+constexpr size_t CHUNK_BYTES = 1 << 16;
+
+struct Decoder {
+  std::vector<char> text;
+  size_t records = 0;
+  int64_t last_timestamp = 0;
+  std::vector<std::string> symbols;
+
+  void flush() {
+    auto *data = text.data();
+    auto size = text.size();
+    while (size) {
+      auto written = write(1, data, size);
+      if (written <= 0) {
+        perror("write");
+        exit(1);
+      }
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+    text.clear();
+  }
+
+  // Appends the line for the record starting at in, if [in, end) holds all of
+  // it, and returns the end of the record. Returns in if the record goes on
+  // past end, and nullptr if it is invalid; the stream state is only changed
+  // by a complete record.
+  const char *decode(const char *in, const char *end) {
+    char line[160];
+    char *out = line;
+    const char *next = in + 1;
+    bool complete = true;
+    auto field = [&] {
+      uint64_t value = 0;
+      complete = complete && getVarint(next, end, value);
+      return value;
+    };
+    auto number = [&](uint64_t value) {
+      out = std::to_chars(out, out + 20, value).ptr;
+      *out++ = ' ';
+    };
+
+    char kind = *in;
+    *out++ = static_cast<char>(kind & ~0x20);
+    *out++ = ' ';
+    number(field());
+    std::string added;
+    switch (kind) {
+    case 'B':
+    case 'S': {
+      auto symbol = field();
+      if (!complete) {
+        break;
+      }
+      if (symbol == symbols.size()) {
+        if (next == end) {
+          return in;
+        }
+        auto length = static_cast<uint8_t>(*next++);
+        if (length == 0 || length > 8) {
+          return nullptr;
+        }
+        if (end - next < length) {
+          return in;
+        }
+        added.assign(next, length);
+        next += length;
+      } else if (symbol > symbols.size()) {
+        return nullptr;
+      }
+      auto &name = symbol < symbols.size() ? symbols[symbol] : added;
+      out = std::copy(name.begin(), name.end(), out);
+      *out++ = ' ';
+      number(field());
+      number(field());
+      break;
+    }
+    case 'E':
+      for (int i = 0; i < 4; ++i) {
+        number(field());
+      }
+      break;
+    case 'X':
+    case 'x':
+      break;
+    case 'M':
+    case 'm':
+      number(field());
+      number(field());
+      break;
+    case 'K':
+      number(field());
+      break;
+    default:
+      return nullptr;
+    }
+    if (kind == 'X' || kind == 'x' || kind == 'M' || kind == 'm') {
+      *out++ = kind == 'X' || kind == 'M' ? 'A' : 'R';
+      *out++ = ' ';
+    }
+    auto delta = unzigzag(field());
+    if (!complete) {
+      // Any valid record fits in MAX_BINARY_RECORD bytes.
+      return end - in >= static_cast<ptrdiff_t>(MAX_BINARY_RECORD) ? nullptr
+                                                                   : in;
+    }
+    if (!added.empty()) {
+      symbols.push_back(std::move(added));
+    }
+    last_timestamp += delta;
+    out = std::to_chars(out, out + 20, last_timestamp).ptr;
+    *out++ = '\n';
+    text.insert(text.end(), line, out);
+    ++records;
+    return next;
+  }
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [file]\n", argv[0]);
+    return 1;
+  }
+  int fd = 0;
+  if (argc == 2 && (fd = open(argv[1], O_RDONLY)) == -1) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  Decoder decoder;
+  decoder.text.reserve(CHUNK_BYTES * 2);
+  // Unconsumed input is buffer[begin, end); a record cut off by the end of
+  // a read is moved to the front before the next one.
+  std::vector<char> buffer(CHUNK_BYTES + MAX_BINARY_RECORD);
+  size_t begin = 0;
+  size_t end = 0;
+  while (true) {
+    memmove(buffer.data(), buffer.data() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+    auto bytes = read(fd, buffer.data() + end, buffer.size() - end);
+    if (bytes < 0) {
+      perror("read");
+      return 1;
+    }
+    if (bytes == 0) {
+      break;
+    }
+    end += static_cast<size_t>(bytes);
+
+    while (begin < end) {
+      auto *record = buffer.data() + begin;
+      auto *next = decoder.decode(record, buffer.data() + end);
+      if (!next) {
+        decoder.flush();
+        fprintf(stderr, "decode: invalid record of kind 0x%02x after %zu "
+                        "records\n",
+                static_cast<unsigned char>(*record), decoder.records);
+        return 1;
+      }
+      if (next == record) {
+        break;
+      }
+      begin = static_cast<size_t>(next - buffer.data());
+    }
+    if (decoder.text.size() >= CHUNK_BYTES) {
+      decoder.flush();
+    }
+  }
+  decoder.flush();
+  if (begin != end) {
+    fprintf(stderr, "decode: input ends inside a record after %zu records\n",
+            decoder.records);
+    return 1;
+  }
+  return 0;
+}
@@ -1,5 +1,14 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -11,7 +20,14 @@
 
 #include "engine.hpp"
 #include "io.hpp"
+#include "journal.hpp"
+#include "matching_workers.hpp"
 #include "order_book.hpp"
+#include "profile.hpp"
+#include "reactor.hpp"
+#include "shm_transport.hpp"
+#include "snapshot.hpp"
+#include "uring.hpp"
 
 void _debug() { SyncCerr{} << '\n'; }
 template <typename Head, typename... Tail> void _debug(Head H, Tail... T) {
@@ -25,17 +41,142 @@ template <typename Head, typename... Tail> void debug(Head H, Tail... T) {
 
 OrderBookNew order_book;
 
+Engine::Engine() : config{EngineConfig::fromEnvironment()} {
+  // Before any thread is started or any timestamp taken.
+  tsc_clock.calibrate();
+  // Before any thread is started; see Profile::start().
+  Profile::start();
+  if (!config.output_path.empty()) {
+    // Onto stdout, which is where OutputMode::Sync writes.
+    int fd = open(config.output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                  0644);
+    if (fd == -1 || dup2(fd, 1) == -1) {
+      perror(config.output_path.c_str());
+      exit(1);
+    }
+    close(fd);
+  }
+  Output::configure(config.output);
+  ReplayStart replay_start;
+  if (!config.snapshot.empty()) {
+    if (loadSnapshot(order_book, config.snapshot.c_str(), replay_start) &&
+        !config.replay.empty() && !replay_start.journaled) {
+      // Its orders would be added a second time by the replay.
+      SyncCerr{} << "replay: " << config.snapshot
+                 << " was saved without a journal, so " << config.replay
+                 << " cannot be replayed on top of it" << std::endl;
+      exit(1);
+    }
+    // Only the snapshot thread takes SIGUSR2; threads inherit the mask.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+  }
+  if (!config.replay.empty()) {
+    // Straight into the book, before any worker owns an instrument.
+    if (!config.replay_print) {
+      Output::configure(OutputMode::Discard);
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto count =
+        replayJournal(order_book, config.replay.c_str(), replay_start);
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (count < 0) {
+      SyncCerr{} << "replay: cannot read " << config.replay << std::endl;
+    } else {
+      SyncCerr{} << "replay: " << count << " commands from " << config.replay
+                 << " in " << elapsed.count() << " ms" << std::endl;
+    }
+    Output::configure(config.output);
+  }
+  if (!config.journal.empty()) {
+    journal = std::make_unique<Journal>(
+        config.journal.c_str(), config.journal_batch_bytes,
+        config.journal_interval_us);
+    order_book.journal = journal.get();
+  }
+  if (config.mode == EngineMode::SHARDED) {
+    workers = std::make_unique<MatchingWorkers>(order_book, config);
+  }
+  if (config.io_threads) {
+    reactor = std::make_unique<Reactor>(*this, config.io_threads);
+  }
+  if (!config.snapshot.empty()) {
+    std::thread(&Engine::snapshot_thread, this).detach();
+  }
+}
+
+Engine::~Engine() = default;
+
 void Engine::accept(ClientConnection connection) {
+  if (reactor) {
+    reactor->add(std::move(connection));
+    return;
+  }
   auto thread =
       std::thread(&Engine::connection_thread, this, std::move(connection));
   thread.detach();
 }
 
+void Engine::serve(int listenfd) {
+  if (config.io_uring && !serveWithUring(*this, listenfd)) {
+    SyncCerr{} << "io_uring unavailable, falling back to blocking accept"
+               << std::endl;
+  }
+}
+
+void Engine::serveShm(int listenfd) {
+  ::serveShm(*this, listenfd, config.shm_spins);
+}
+
+void Engine::drain() {
+  if (workers) {
+    // Queued behind everything submitted before it on every worker.
+    workers->forEachInstrument([](InstrumentNew &) {});
+  }
+}
+
+void Engine::forEachInstrument(
+    const std::function<void(InstrumentNew &)> &fn) {
+  if (workers) {
+    workers->forEachInstrument(fn);
+    return;
+  }
+  order_book.instruments.forEach([&](InstrumentNew &instrument) {
+    // The locks saveSnapshot() holds while capturing an instrument.
+    std::scoped_lock lock{instrument.execute_buy_lk, instrument.execute_sell_lk,
+                          instrument.insert_lk, instrument.combiner.combine_lk,
+                          instrument.journal_lk};
+    fn(instrument);
+  });
+}
+
+void Engine::snapshot_thread() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR2);
+  auto interval_ms = config.snapshot_interval_ms;
+  timespec interval{static_cast<time_t>(interval_ms / 1000),
+                    static_cast<long>(interval_ms % 1000) * 1'000'000};
+  while (true) {
+    auto signum = interval_ms ? sigtimedwait(&set, nullptr, &interval)
+                              : sigwaitinfo(&set, nullptr);
+    if (signum == -1 && errno != EAGAIN) {
+      continue; // EINTR
+    }
+    saveSnapshot(order_book, workers.get(), config.snapshot.c_str());
+  }
+}
+
 void Engine::connection_thread(ClientConnection connection) {
+  ClientCommand inputs[ClientConnection::BUFFER_COMMANDS];
   while (true) {
-    ClientCommand input{};
-    switch (connection.readInput(input)) {
+    size_t count;
+    switch (connection.readBatch(inputs, std::size(inputs), count)) {
     case ReadResult::Error:
+    case ReadResult::WouldBlock:
       SyncCerr{} << "Error reading input" << std::endl;
     case ReadResult::EndOfFile:
       return;
@@ -43,47 +184,81 @@ void Engine::connection_thread(ClientConnection connection) {
       break;
     }
 
-    // Functions for printing output actions in the prescribed format are
-    // provided in the Output class:
-    switch (input.type) {
-    case input_cancel: {
-      order_book.processCancelOrder(input.order_id);
-      break;
-    }
+    handleCommands(inputs, count);
+  }
+}
 
-    case input_buy: {
-      // Remember to take timestamp at the appropriate time, or compute
-      // an appropriate timestamp!
-      order_book.processBuyOrder(input.order_id, input.price, input.count,
-                                 input.instrument);
-      break;
-    }
+void Engine::handleCommand(const ClientCommand &input) {
+  InstrumentCache cache;
+  handleCommand(input, cache);
+}
 
-    case input_sell: {
-      order_book.processSellOrder(input.order_id, input.price, input.count,
-                                  input.instrument);
-      break;
-    }
+void Engine::handleCommands(const ClientCommand *inputs, size_t count) {
+  Output::Batch batch;
+  InstrumentCache cache;
+  for (size_t i = 0; i < count; ++i) {
+    handleCommand(inputs[i], cache);
+  }
+}
 
-    default: {
-      // Remember to take timestamp at the appropriate time, or compute
-      // an appropriate timestamp!
-      auto output_time = getCurrentTimestamp();
-      Output::OrderAdded(input.order_id, input.instrument, input.price,
-                         input.count, input.type == input_sell, output_time);
-      break;
-    }
-    }
+void Engine::handleCommand(const ClientCommand &input, InstrumentCache &cache) {
+  if (workers) {
+    workers->submit(input, cache);
+    return;
+  }
+  if (config.mode == EngineMode::COMBINING) {
+    order_book.combineCommand(input, cache);
+    return;
+  }
 
-    // Additionally:
+  // Functions for printing output actions in the prescribed format are
+  // provided in the Output class:
+  switch (input.type) {
+  case input_cancel: {
+    order_book.processCancelOrder(input.order_id);
+    break;
+  }
 
+  case input_buy:
+  case input_buy_ioc:
+  case input_buy_fok: {
     // Remember to take timestamp at the appropriate time, or compute
     // an appropriate timestamp!
-    /*
-    intmax_t output_time = getCurrentTimestamp();
+    auto &instrument =
+        order_book.ensureInstrumentExists(input.instrument, cache);
+    order_book.runJournaled(
+        instrument, input.type, input.order_id, input.price, input.count, [&] {
+          instrument.handleBuyOrder(input.order_id, input.price, input.count,
+                                    timeInForceOf(input.type));
+        });
+    break;
+  }
 
-    // Check the parameter names in `io.hpp`.
-    Output::OrderExecuted(123, 124, 1, 2000, 10, output_time);
-    */
+  case input_sell:
+  case input_sell_ioc:
+  case input_sell_fok: {
+    auto &instrument =
+        order_book.ensureInstrumentExists(input.instrument, cache);
+    order_book.runJournaled(
+        instrument, input.type, input.order_id, input.price, input.count, [&] {
+          instrument.handleSellOrder(input.order_id, input.price, input.count,
+                                     timeInForceOf(input.type));
+        });
+    break;
+  }
+
+  case input_amend: {
+    order_book.processAmendOrder(input.order_id, input.price, input.count);
+    break;
+  }
+
+  default: {
+    // Remember to take timestamp at the appropriate time, or compute
+    // an appropriate timestamp!
+    Output::OrderAdded(input.order_id, input.instrument, input.price,
+                       input.count, input.type == input_sell,
+                       order_book.timestamp);
+    break;
+  }
   }
 }
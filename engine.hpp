@@ -5,16 +5,63 @@
 #define ENGINE_HPP
 
 #include <chrono>
+#include <functional>
+#include <memory>
 
+#include "config.hpp"
 #include "io.hpp"
 
+struct InstrumentCache;
+struct InstrumentNew;
+struct Journal;
+struct MatchingWorkers;
+struct Reactor;
+
 struct Engine
 {
 public:
+	Engine();
+	~Engine();
+
 	void accept(ClientConnection conn);
 
+	// Serves listenfd through io_uring if configured and supported, and never
+	// returns in that case. Otherwise returns at once, and connections are
+	// accepted by the caller and passed to accept().
+	void serve(int listenfd);
+
+	// Serves shared-memory clients handing their regions over listenfd, from
+	// threads of their own; returns at once.
+	void serveShm(int listenfd);
+
+	// Decodes one command and hands it to the book or the matching workers.
+	void handleCommand(const ClientCommand& input);
+
+	// Handles a frame, or any run of commands, as a unit: a run of commands
+	// for one instrument looks it up once, and the output is flushed once.
+	void handleCommands(const ClientCommand* inputs, size_t count);
+
+	// Returns once every command handed to handleCommand() so far has been
+	// matched, including those still queued for the matching workers.
+	void drain();
+	// Runs fn on every instrument while no command runs on it: with the
+	// instrument's locks held, or on its worker in EngineMode::SHARDED,
+	// where instruments of different workers are visited concurrently.
+	void forEachInstrument(const std::function<void(InstrumentNew&)>& fn);
+
 private:
+	EngineConfig config;
+	// Only set in EngineMode::SHARDED.
+	std::unique_ptr<MatchingWorkers> workers;
+	// Only set when config.io_threads is non-zero.
+	std::unique_ptr<Reactor> reactor;
+	// Only set when config.journal is.
+	std::unique_ptr<Journal> journal;
+
 	void connection_thread(ClientConnection conn);
+	void handleCommand(const ClientCommand& input, InstrumentCache& cache);
+	// Saves config.snapshot on SIGUSR2 and every config.snapshot_interval_ms.
+	void snapshot_thread();
 };
 
 inline std::chrono::microseconds::rep getCurrentTimestamp() noexcept
@@ -0,0 +1,73 @@
+#include "event_clock.hpp"
+
+#include <time.h>
+
+#include <chrono>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define ENGINE_HAVE_TSC 1
+#endif
+
+namespace {
+
+intmax_t monotonicNs() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return intmax_t{now.tv_sec} * 1'000'000'000 + now.tv_nsec;
+}
+
+#ifdef ENGINE_HAVE_TSC
+// lfence keeps rdtsc from executing ahead of earlier instructions, in
+// particular the store that claims an output slot.
+uint64_t readTsc() {
+  _mm_lfence();
+  return __rdtsc();
+}
+
+bool hasInvariantTsc() {
+  unsigned eax, ebx, ecx, edx;
+  return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+}
+#endif
+
+} // namespace
+
+void TscClock::calibrate() {
+  auto start_ns = monotonicNs();
+  // Counts from here on CLOCK_MONOTONIC, unless the TSC is usable.
+  offset = -start_ns;
+#ifdef ENGINE_HAVE_TSC
+  if (!hasInvariantTsc()) {
+    return;
+  }
+  auto start_tsc = readTsc();
+  std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  auto elapsed_ns = monotonicNs() - start_ns;
+  auto elapsed_tsc = readTsc() - start_tsc;
+  if (elapsed_ns <= 0 || elapsed_tsc == 0) {
+    return;
+  }
+  base = start_tsc;
+  mult = (static_cast<uint64_t>(elapsed_ns) << 32) / elapsed_tsc;
+  offset = 0;
+#endif
+}
+
+intmax_t TscClock::now() const {
+#ifdef ENGINE_HAVE_TSC
+  if (mult) {
+    // 96-bit product, split so that neither half overflows.
+    auto ticks = readTsc() - base;
+    return offset + static_cast<intmax_t>((ticks >> 32) * mult +
+                                          (((ticks & 0xffffffff) * mult) >> 32));
+  }
+#endif
+  return offset + monotonicNs();
+}
+
+// Constant-initialised, so it is valid from the start for every translation
+// unit, whatever the order of their static initialisation.
+constinit TscClock tsc_clock;
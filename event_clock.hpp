@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+// Nanoseconds since calibrate(), read from the invariant TSC when the CPU has
+// one and from CLOCK_MONOTONIC otherwise. Both are consistent across cores,
+// so a reading taken after another (in real time, on any thread) is never
+// smaller. Until calibrate() is called, readings are plain CLOCK_MONOTONIC
+// nanoseconds, which is all that tools only timing intervals need.
+struct TscClock {
+  // Converts TSC ticks since base to nanoseconds as (ticks * mult) >> 32.
+  // mult is 0 when the TSC is not usable.
+  uint64_t base = 0;
+  uint64_t mult = 0;
+  // Added to every reading. Restoring a snapshot moves it forward so that
+  // timestamps continue after those of the previous run; it must not change
+  // once other threads read the clock.
+  intmax_t offset = 0;
+
+  // Switches to the TSC if it is usable, which takes about 10 ms, and starts
+  // counting from 0. Called by Engine::Engine() before any other thread
+  // reads the clock; readings taken before are not comparable with later
+  // ones.
+  void calibrate();
+
+  intmax_t now() const;
+};
+
+extern TscClock tsc_clock;
+
+// Source of output timestamps. Output takes the timestamp from the clock
+// itself, after it has reserved the event's place in the output stream.
+//
+// Each instrument has its own clock, so taking a timestamp touches no
+// shared cache line. Timestamps are strictly increasing per clock, and
+// across clocks they follow real time: an event that happens after another
+// (including one on a different instrument) is stamped at or after it, up to
+// the few nanoseconds a clock can run ahead of real time while handing out
+// distinct values.
+struct EventClock {
+  std::atomic<intmax_t> last{-1};
+
+  intmax_t next() {
+    auto now = tsc_clock.now();
+    auto prev = last.load(std::memory_order_relaxed);
+    intmax_t stamp;
+    do {
+      stamp = std::max(now, prev + 1);
+    } while (!last.compare_exchange_weak(prev, stamp,
+                                         std::memory_order_relaxed));
+    return stamp;
+  }
+};
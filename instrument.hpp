@@ -15,34 +15,88 @@
 #include <thread>
 #include <unordered_map>
 
+#include "flat_combining.hpp"
 #include "io.hpp"
+#include "journal.hpp"
+#include "order_index.hpp"
+#include "order_queue.hpp"
+#include "price_levels.hpp"
+#include "profile.hpp"
 
 enum SIDE { BUY, SELL };
 
-struct OrderNew {
-  uint32_t id;
-  uint32_t price;
-  uint32_t count;
-  uint32_t execution_id;
+// How long the unexecuted part of a buy or sell lasts.
+enum class TimeInForce {
+  // Rests on the book until executed or cancelled.
+  GoodTillCancel,
+  // Executes what it can at once; the rest is dropped and never rests.
+  ImmediateOrCancel,
+  // Executes in full at once, or not at all.
+  FillOrKill,
+};
+
+// The side and time in force of a buy or sell command.
+inline bool isSellCommand(CommandType type) {
+  return type == input_sell || type == input_sell_ioc ||
+         type == input_sell_fok;
+}
+
+inline TimeInForce timeInForceOf(CommandType type) {
+  switch (type) {
+  case input_buy_ioc:
+  case input_sell_ioc:
+    return TimeInForce::ImmediateOrCancel;
+  case input_buy_fok:
+  case input_sell_fok:
+    return TimeInForce::FillOrKill;
+  default:
+    return TimeInForce::GoodTillCancel;
+  }
+}
+
+// Scoped lock that compiles away when Locked is false. The matching code is
+// shared between the concurrent path, where every connection thread may enter
+// an instrument, and single-writer callers that own the instrument outright.
+template <bool Locked> struct MaybeLock {
+  std::mutex &mtx;
+
+  explicit MaybeLock(std::mutex &_mtx) : mtx{_mtx} {
+    if constexpr (Locked) {
+      Profile::lock(mtx);
+    }
+  }
+
+  ~MaybeLock() {
+    if constexpr (Locked) {
+      mtx.unlock();
+    }
+  }
+
+  MaybeLock(const MaybeLock &) = delete;
+  MaybeLock &operator=(const MaybeLock &) = delete;
 };
 
-struct LimitNew {
-  // FIFO list of orders at this price
-  std::list<OrderNew> orders;
+// A command for one instrument, as published to its flat combiner.
+struct CombinedCommand {
+  CommandType type;
+  uint32_t order_id;
+  uint32_t price;
+  uint32_t count;
+  // Cancels and amends: where the order index last saw the order.
+  OrderLocation location;
 };
 
 struct InstrumentNew {
   // TODO: use a concurrent BST
 
   // Maps price to the Limit that price
-  std::map<uint32_t, std::unique_ptr<LimitNew>, std::greater<uint32_t>>
-      buy_limits; // greatest price is at begin()
-  std::map<uint32_t, std::unique_ptr<LimitNew>> sell_limits;
+  BuyLevels buy_limits; // greatest price is best()
+  SellLevels sell_limits;
 
-  // Maps order_id to iterator
-  // Used for deleting orders directly from their lists.
-  std::unordered_map<uint32_t, std::list<OrderNew>::iterator> buy_orders;
-  std::unordered_map<uint32_t, std::list<OrderNew>::iterator> sell_orders;
+  // Backing storage for the resting orders of each side. Guarded by the
+  // corresponding limits lock.
+  OrderPool buy_pool;
+  OrderPool sell_pool;
 
   // ensure only 1 of each can run concurrently
   std::mutex execute_buy_lk;
@@ -55,176 +109,426 @@ struct InstrumentNew {
   std::mutex buy_limits_lk;
   std::mutex sell_limits_lk;
 
+  // Held around each command and its journal record while journaling in
+  // EngineMode::THREADED, which serialises the instrument's commands; see
+  // Journal.
+  std::mutex journal_lk;
+
   std::string name;
 
-  // Global timestamp from OrderBookNew
-  std::atomic<intmax_t> &timestamp;
+  // Output clock of this instrument's events.
+  EventClock timestamp;
+
+  // Index of order_id to resting order location from OrderBookNew (across
+  // all instruments). Entries are added and removed with the side's limits
+  // lock held.
+  OrderIndex &orders;
 
-  // Map of order_id to Instrument ptr from OrderBooknew (across all
-  // instruments).
-  std::unordered_map<uint32_t, InstrumentNew *> &global_orders;
-  std::mutex &global_orders_mtx;
+  // EngineMode::COMBINING runs every command through this instead of the
+  // locks above; see combine().
+  FlatCombiner<CombinedCommand> combiner;
 
-  InstrumentNew(std::string _name, std::atomic<intmax_t> &_timestamp,
-                std::unordered_map<uint32_t, InstrumentNew *> &_global_orders,
-                std::mutex &_global_orders_mtx)
-      : name{_name}, timestamp{_timestamp}, global_orders{_global_orders},
-        global_orders_mtx{_global_orders_mtx} {}
+  InstrumentNew(std::string _name, OrderIndex &_orders)
+      : name{_name}, orders{_orders} {}
 
   LimitNew &ensureLimitExists(uint32_t price, bool is_sell) {
-    auto &limit = is_sell ? sell_limits[price] : buy_limits[price];
-    if (!limit) {
-      limit = std::make_unique<LimitNew>();
+    return is_sell ? sell_limits.ensure(price) : buy_limits.ensure(price);
+  }
+
+  // Executes order against the first order of the best opposite level, if
+  // their prices cross. Returns whether they did. Must be called with the
+  // opposite side's limits lock held.
+  bool matchBest(OrderNew &order, bool is_sell, auto &&opp_limits,
+                 OrderPool &opp_pool) {
+    auto [opp_price, opp_limit] = opp_limits.best();
+    if (!opp_limit) {
+      // No more opp orders.
+      return false;
+    }
+
+    if ((is_sell && opp_price < order.price) ||
+        (!is_sell && opp_price > order.price)) {
+      // Opp price does not match.
+      return false;
     }
-    return *limit;
+
+    // Get the first order in the limit and execute it.
+    auto &opp_order = opp_pool[opp_limit->orders.front()];
+    auto matched_count = std::min(order.count, opp_order.count);
+    order.count -= matched_count;
+    opp_order.count -= matched_count;
+    opp_limit->quantity -= matched_count;
+    Output::OrderExecuted(opp_order.id, order.id, opp_order.execution_id,
+                          opp_order.price, matched_count, timestamp);
+    ++opp_order.execution_id;
+
+    // Delete the resting order if it's depleted.
+    if (!opp_order.count) {
+      orders.erase(opp_order.id);
+      opp_limit->remove(opp_pool, opp_limit->orders.front());
+      if (opp_limit->orders.empty()) {
+        opp_limits.erase(opp_price, *opp_limit);
+      }
+    }
+    return true;
   }
 
-  void handleBuyOrSellOrder(uint32_t order_id, uint32_t price, uint32_t count,
+  // Matches the order against the opposite side and rests the remainder, or
+  // with TimeInForce::ImmediateOrCancel drops it. Returns whether anything
+  // was rested.
+  template <bool Locked>
+  bool handleBuyOrSellOrder(uint32_t order_id, uint32_t price, uint32_t count,
                             auto &&opp_limits, bool is_sell, auto &&_limits_lk,
-                            auto &&_opp_limits_lk) {
-    OrderNew order{order_id, price, count, 1};
+                            auto &&_opp_limits_lk,
+                            TimeInForce tif = TimeInForce::GoodTillCancel) {
+    OrderNew order{order_id, price, count, 1, NULL_HANDLE, NULL_HANDLE,
+                   nullptr};
+    auto &pool = is_sell ? sell_pool : buy_pool;
+    auto &opp_pool = is_sell ? buy_pool : sell_pool;
     while (true) {
       while (order.count) {
         // Get best limit
         {
           // turnstile
-          std::lock_guard insert_lock{insert_lk};
-        }
-        std::lock_guard opp_limits_lk{_opp_limits_lk};
-
-        auto limit_it = opp_limits.begin();
-        if (limit_it == opp_limits.end()) {
-          // No more opp orders.
-          break;
+          MaybeLock<Locked> insert_lock{insert_lk};
         }
-
-        auto &[opp_price, opp_limit] = *limit_it;
-        if ((is_sell && opp_price < price) || (!is_sell && opp_price > price)) {
-          // Opp price does not match.
+        MaybeLock<Locked> opp_limits_lk{_opp_limits_lk};
+        if (!matchBest(order, is_sell, opp_limits, opp_pool)) {
           break;
         }
-
-        // Get the first order in the limit and execute it.
-        auto &opp_order = opp_limit->orders.front();
-        auto matched_count = std::min(order.count, opp_order.count);
-        order.count -= matched_count;
-        opp_order.count -= matched_count;
-        Output::OrderExecuted(opp_order.id, order_id, opp_order.execution_id,
-                              opp_order.price, matched_count,
-                              timestamp.fetch_add(1, std::memory_order_relaxed));
-        ++opp_order.execution_id;
-        ++timestamp;
-
-        // Delete the resting order if it's depleted.
-        if (!opp_order.count) {
-          {
-            std::lock_guard global_orders_lock{global_orders_mtx};
-            global_orders.erase(opp_order.id);
-          }
-
-          if (is_sell) {
-            buy_orders.erase(opp_order.id);
-          } else {
-            sell_orders.erase(opp_order.id);
-          }
-
-          opp_limit->orders.pop_front();
-          if (opp_limit->orders.empty()) {
-            opp_limits.erase(limit_it);
-          }
-        }
       }
       // post matching phase
       if (!order.count) {
-        return;
+        return false;
+      }
+      if (tif == TimeInForce::ImmediateOrCancel) {
+        // Nothing on the resting side is touched for the remainder.
+        Output::OrderKilled(order_id, order.count, timestamp);
+        return false;
       }
 
-      std::lock_guard insert_lock{insert_lk};
+      MaybeLock<Locked> insert_lock{insert_lk};
       {
-        std::lock_guard opp_limits_lk{_opp_limits_lk};
-        auto limit_it = opp_limits.begin();
-        if (limit_it != opp_limits.end()) {
-          auto &[new_opp_price, new_opp_limit] = *limit_it;
+        MaybeLock<Locked> opp_limits_lk{_opp_limits_lk};
+        auto [new_opp_price, new_opp_limit] = opp_limits.best();
+        if (new_opp_limit) {
           if ((is_sell && new_opp_price >= price) || (!is_sell && new_opp_price <= price)) {
             continue;
           }
         }
       }
 
-      std::lock_guard limits_lk{_limits_lk};
+      MaybeLock<Locked> limits_lk{_limits_lk};
 
       auto &limit = ensureLimitExists(price, is_sell);
-      limit.orders.push_back(order);
+      auto handle = limit.push(pool, order);
+      orders.assign(order.id, {this, handle, is_sell});
 
-      if (is_sell) {
-        sell_orders[order.id] = prev(limit.orders.end());
-      } else {
-        buy_orders[order.id] = prev(limit.orders.end());
-      }
+      Output::OrderAdded(order_id, name.c_str(), price, order.count, is_sell,
+                         timestamp);
+      return true;
+    }
+  }
 
-      {
-        std::lock_guard global_orders_lock{global_orders_mtx};
-        global_orders[order.id] = this;
+  // Re-runs an amended order as handleBuyOrSellOrder() would, but in one go:
+  // the caller holds the insert lock throughout, from taking the order out
+  // of its level until it rests again. No cancel or amend of it, and no
+  // resting order of either side, can get in between.
+  template <bool Locked>
+  bool rerunAmended(OrderNew &order, bool is_sell, auto &&opp_limits,
+                    auto &&_limits_lk, auto &&_opp_limits_lk) {
+    auto &pool = is_sell ? sell_pool : buy_pool;
+    auto &opp_pool = is_sell ? buy_pool : sell_pool;
+    {
+      MaybeLock<Locked> opp_limits_lk{_opp_limits_lk};
+      while (order.count && matchBest(order, is_sell, opp_limits, opp_pool)) {
       }
+    }
+    if (!order.count) {
+      return false;
+    }
+    MaybeLock<Locked> limits_lk{_limits_lk};
+    auto &limit = ensureLimitExists(order.price, is_sell);
+    auto handle = limit.push(pool, order);
+    orders.assign(order.id, {this, handle, is_sell});
+    Output::OrderAdded(order.id, name.c_str(), order.price, order.count,
+                       is_sell, timestamp);
+    return true;
+  }
 
-      Output::OrderAdded(order_id, name.c_str(), price, order.count, is_sell,
-                         timestamp.fetch_add(1, std::memory_order_relaxed));
-      ++timestamp;
+  // Executes the whole order at once, or none of it. The opposite side's
+  // depth within the price is summed from the level aggregates first, and
+  // the order is only matched if it covers count. The insert lock and the
+  // opposite limits lock are held throughout, so no cancel or amend can
+  // take liquidity away between the check and the matching.
+  template <bool Locked>
+  void handleFillOrKill(uint32_t order_id, uint32_t price, uint32_t count,
+                        auto &&opp_limits, bool is_sell,
+                        auto &&_opp_limits_lk) {
+    OrderNew order{order_id, price, count, 1, NULL_HANDLE, NULL_HANDLE,
+                   nullptr};
+    MaybeLock<Locked> insert_lock{insert_lk};
+    MaybeLock<Locked> opp_limits_lk{_opp_limits_lk};
+    uint64_t available = 0;
+    opp_limits.forEachBest([&](uint32_t opp_price, const LimitNew &limit) {
+      if (is_sell ? opp_price < price : opp_price > price) {
+        return false;
+      }
+      available += limit.quantity;
+      return available < count;
+    });
+    if (available < count) {
+      Output::OrderKilled(order_id, count, timestamp);
       return;
     }
+    auto &opp_pool = is_sell ? buy_pool : sell_pool;
+    while (order.count && matchBest(order, is_sell, opp_limits, opp_pool)) {
+    }
   }
 
-  void handleBuyOrder(uint32_t order_id, uint32_t price, uint32_t count) {
-    std::lock_guard execute_lk{execute_buy_lk};
-    handleBuyOrSellOrder(order_id, price, count, sell_limits, BUY, buy_limits_lk, sell_limits_lk);
+  // A buy or sell with the given time in force. Returns whether anything was
+  // rested, which only orders good till cancelled do.
+  template <bool Locked = true>
+  bool handleBuyOrder(uint32_t order_id, uint32_t price, uint32_t count,
+                      TimeInForce tif = TimeInForce::GoodTillCancel) {
+    ProfileTimer timer{ProfileStage::Match};
+    ProfileInstrument profile{name};
+    MaybeLock<Locked> execute_lk{execute_buy_lk};
+    if (tif == TimeInForce::FillOrKill) {
+      handleFillOrKill<Locked>(order_id, price, count, sell_limits, BUY,
+                               sell_limits_lk);
+      return false;
+    }
+    return handleBuyOrSellOrder<Locked>(order_id, price, count, sell_limits,
+                                        BUY, buy_limits_lk, sell_limits_lk,
+                                        tif);
   }
 
-  void handleSellOrder(uint32_t order_id, uint32_t price, uint32_t count) {
-    std::lock_guard execute_lk{execute_sell_lk};
-    handleBuyOrSellOrder(order_id, price, count, buy_limits, SELL, sell_limits_lk, buy_limits_lk);
+  template <bool Locked = true>
+  bool handleSellOrder(uint32_t order_id, uint32_t price, uint32_t count,
+                       TimeInForce tif = TimeInForce::GoodTillCancel) {
+    ProfileTimer timer{ProfileStage::Match};
+    ProfileInstrument profile{name};
+    MaybeLock<Locked> execute_lk{execute_sell_lk};
+    if (tif == TimeInForce::FillOrKill) {
+      handleFillOrKill<Locked>(order_id, price, count, buy_limits, SELL,
+                               buy_limits_lk);
+      return false;
+    }
+    return handleBuyOrSellOrder<Locked>(order_id, price, count, buy_limits,
+                                        SELL, sell_limits_lk, buy_limits_lk,
+                                        tif);
   }
 
-  void handleCancelOrder(uint32_t order_id) {
-    std::lock_guard execute_lk{insert_lk};
-    {
-      std::lock_guard lock{buy_limits_lk};
-      auto it = buy_orders.find(order_id);
-      if (it != buy_orders.end()) {
-        auto order_it = it->second;
-        auto limit_it = buy_limits.find(order_it->price);
-        auto &orders = limit_it->second->orders;
-        orders.erase(order_it);
-        if (orders.empty()) {
-          buy_limits.erase(limit_it);
-        }
-        Output::OrderDeleted(order_id, true,
-                             timestamp.fetch_add(1, std::memory_order_relaxed));
-        ++timestamp;
-        global_orders.erase(order_id);
+  // Cancels order_id, which the order index last saw resting on the given
+  // side at handle. The location is re-validated under the side's lock, as
+  // the order may have been filled in the meantime.
+  template <bool Locked = true>
+  void handleCancelOrder(uint32_t order_id, const OrderLocation &location) {
+    ProfileTimer timer{ProfileStage::Cancel};
+    ProfileInstrument profile{name};
+    MaybeLock<Locked> execute_lk{insert_lk};
+    if (location.is_sell) {
+      MaybeLock<Locked> lock{sell_limits_lk};
+      if (cancelResting(order_id, currentHandle(order_id, location, sell_pool),
+                        sell_limits, sell_pool)) {
+        return;
+      }
+    } else {
+      MaybeLock<Locked> lock{buy_limits_lk};
+      if (cancelResting(order_id, currentHandle(order_id, location, buy_pool),
+                        buy_limits, buy_pool)) {
         return;
-      } 
+      }
+    }
+    // order that we want to cancel must've been consumed, reject cancel
+    Output::OrderDeleted(order_id, false, timestamp);
+  }
+
+  // Best bid and best ask. All fields are 0 when the side is empty.
+  template <bool Locked = true> DepthLevel bestBid() {
+    return bestLevel<Locked>(buy_limits, buy_limits_lk);
+  }
+
+  template <bool Locked = true> DepthLevel bestAsk() {
+    return bestLevel<Locked>(sell_limits, sell_limits_lk);
+  }
+
+  // Writes the aggregates of up to n best levels of one side to out, best
+  // first, and returns how many were written. Only reads the per-level
+  // aggregates, never the orders, and only takes the side's limits lock.
+  template <bool Locked = true>
+  size_t depth(bool is_sell, DepthLevel *out, size_t n) {
+    auto collect = [&](auto &limits, std::mutex &_limits_lk) {
+      MaybeLock<Locked> limits_lk{_limits_lk};
+      size_t written = 0;
+      if (n) {
+        limits.forEachBest([&](uint32_t price, const LimitNew &limit) {
+          out[written++] = {price, limit.order_count, limit.quantity};
+          return written < n;
+        });
+      }
+      return written;
+    };
+    return is_sell ? collect(sell_limits, sell_limits_lk)
+                   : collect(buy_limits, buy_limits_lk);
+  }
+
+  template <bool Locked>
+  static DepthLevel bestLevel(auto &limits, std::mutex &_limits_lk) {
+    MaybeLock<Locked> limits_lk{_limits_lk};
+    auto [price, limit] = limits.best();
+    if (!limit) {
+      return {0, 0, 0};
     }
+    return {price, limit->order_count, limit->quantity};
+  }
+
+  // Changes a resting order to price and count. Lowering the count at the
+  // same price only updates the order and its level, so the order keeps its
+  // place in the queue. Any other change takes the order out of its level and
+  // runs it again as a new order at the new price, with the same id: it may
+  // execute against the opposite side and rests at the back of its new
+  // level. Either way "M ... A" comes first; a re-run then prints its
+  // executions and, if anything is left, a "B"/"S" line for the rest, as a
+  // new order would. Amends of orders that no longer rest, and amends to a
+  // count of 0, are rejected.
+  //
+  // location is where the order index last saw the order, as for
+  // handleCancelOrder(). The order is taken out and re-run under its side's
+  // execute lock and the insert lock, so no other order of that side matches,
+  // and no cancel or amend sees the order, in between.
+  template <bool Locked = true>
+  void handleAmendOrder(uint32_t order_id, const OrderLocation &location,
+                        uint32_t price, uint32_t count) {
+    ProfileTimer timer{ProfileStage::Amend};
+    ProfileInstrument profile{name};
+    auto is_sell = location.is_sell;
+    MaybeLock<Locked> execute_lk{is_sell ? execute_sell_lk : execute_buy_lk};
+    MaybeLock<Locked> insert_lock{insert_lk};
+    OrderNew amended{order_id, price, count, 1, NULL_HANDLE, NULL_HANDLE,
+                     nullptr};
     {
-      std::lock_guard lock{sell_limits_lk};
-      auto it = sell_orders.find(order_id);
-      if (it != sell_orders.end()) {
-        auto order_it = it->second;
-        auto limit_it = sell_limits.find(order_it->price);
-        auto &orders = limit_it->second->orders;
-        orders.erase(order_it);
-        if (orders.empty()) {
-          sell_limits.erase(limit_it);
-        }
-        Output::OrderDeleted(order_id, true,
-                             timestamp.fetch_add(1, std::memory_order_relaxed));
-        ++timestamp;
-        global_orders.erase(order_id);
+      MaybeLock<Locked> limits_lk{is_sell ? sell_limits_lk : buy_limits_lk};
+      auto &pool = is_sell ? sell_pool : buy_pool;
+      auto handle = currentHandle(order_id, location, pool);
+      if (!count || !pool.holds(handle, order_id)) {
+        Output::OrderAmended(order_id, price, count, false, timestamp);
+        return;
+      }
+      auto &order = pool[handle];
+      if (price == order.price && count <= order.count) {
+        order.limit->quantity -= order.count - count;
+        order.count = count;
+        Output::OrderAmended(order_id, price, count, true, timestamp);
         return;
       }
+      amended.execution_id = order.execution_id;
+      auto old_price = order.price;
+      auto &limit = *order.limit;
+      limit.remove(pool, handle);
+      if (limit.orders.empty()) {
+        if (is_sell) {
+          sell_limits.erase(old_price, limit);
+        } else {
+          buy_limits.erase(old_price, limit);
+        }
+      }
+      Output::OrderAmended(order_id, price, count, true, timestamp);
     }
-    // order that we want to cancel must've been consumed, reject cancel
-    Output::OrderDeleted(order_id, false,
-                         timestamp.fetch_add(1, std::memory_order_relaxed));
-    ++timestamp;
+    auto rested = is_sell ? rerunAmended<Locked>(amended, SELL, buy_limits,
+                                                 sell_limits_lk, buy_limits_lk)
+                          : rerunAmended<Locked>(amended, BUY, sell_limits,
+                                                 buy_limits_lk, sell_limits_lk);
+    if (!rested) {
+      orders.erase(order_id);
+    }
+  }
+
+  // Runs command on whichever thread holds the combiner role, through the
+  // unlocked handlers, and returns once it has run and been appended to
+  // journal, if given. Only for EngineMode::COMBINING: nothing else may enter
+  // the instrument meanwhile.
+  void combine(const CombinedCommand &command, Journal *journal) {
+    combiner.run(command, [this, journal](const CombinedCommand &c) {
+      switch (c.type) {
+      case input_buy:
+      case input_buy_ioc:
+      case input_buy_fok:
+        handleBuyOrder<false>(c.order_id, c.price, c.count,
+                              timeInForceOf(c.type));
+        break;
+      case input_sell:
+      case input_sell_ioc:
+      case input_sell_fok:
+        handleSellOrder<false>(c.order_id, c.price, c.count,
+                               timeInForceOf(c.type));
+        break;
+      case input_cancel:
+        handleCancelOrder<false>(c.order_id, c.location);
+        break;
+      case input_amend:
+        handleAmendOrder<false>(c.order_id, c.location, c.price, c.count);
+        break;
+      }
+      if (journal) {
+        journal->append(c.type, c.order_id, c.price, c.count, name);
+      }
+    });
+  }
+
+  // Calls fn(order, is_sell) for every resting order, in queue order within
+  // each price level. The caller must keep matching out of the instrument,
+  // e.g. by holding its execute and insert locks.
+  template <typename Fn> void forEachOrder(Fn &&fn) {
+    auto visit = [&](auto &limits, OrderPool &pool, bool is_sell) {
+      limits.forEach([&](uint32_t, LimitNew &limit) {
+        for (auto handle = limit.orders.front(); handle != NULL_HANDLE;
+             handle = pool[handle].next) {
+          fn(pool[handle], is_sell);
+        }
+      });
+    };
+    visit(buy_limits, buy_pool, BUY);
+    visit(sell_limits, sell_pool, SELL);
+  }
+
+  // Rests order at the back of its level without matching or printing it,
+  // as when restoring a snapshot. Orders must be restored in queue order.
+  void restoreOrder(const OrderNew &order, bool is_sell) {
+    auto &pool = is_sell ? sell_pool : buy_pool;
+    auto handle = ensureLimitExists(order.price, is_sell).push(pool, order);
+    orders.assign(order.id, {this, handle, is_sell});
+  }
+
+  // Removes a resting order if handle still refers to it. Must be called with
+  // the side's limits lock held.
+  // The handle of order_id if it still rests where location says, or else
+  // where the order index has it now: an amend may have moved it since
+  // location was looked up. Must be called with the insert lock and the
+  // side's limits lock held, under which amended orders are re-rested.
+  OrderHandle currentHandle(uint32_t order_id, const OrderLocation &location,
+                            const OrderPool &pool) {
+    if (pool.holds(location.handle, order_id)) {
+      return location.handle;
+    }
+    auto moved = orders.find(order_id);
+    return moved && moved->instrument == this ? moved->handle : NULL_HANDLE;
+  }
+
+  bool cancelResting(uint32_t order_id, OrderHandle handle, auto &&limits,
+                     OrderPool &pool) {
+    if (!pool.holds(handle, order_id)) {
+      return false;
+    }
+    auto price = pool[handle].price;
+    auto &limit = *pool[handle].limit;
+    limit.remove(pool, handle);
+    if (limit.orders.empty()) {
+      limits.erase(price, limit);
+    }
+    orders.erase(order_id);
+    Output::OrderDeleted(order_id, true, timestamp);
+    return true;
   }
 };
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "instrument.hpp"
+
+// Packs a symbol of at most 8 chars into an integer key. Symbols on the wire
+// are not guaranteed to be NUL-terminated within their 9 bytes, so never read
+// past the 8th char.
+inline uint64_t packSymbol(const char *symbol) {
+  uint64_t key = 0;
+  memcpy(&key, symbol, strnlen(symbol, 8));
+  return key;
+}
+
+// Maps packed symbols to Instruments.
+//
+// Lookups of existing instruments are wait-free: they probe an open-addressing
+// table without taking any lock. Only creating an instrument takes the mutex.
+// Slots are published by storing the instrument pointer with release
+// semantics after the key is written, and are never changed afterwards.
+//
+// When the table fills up, it is copied into one twice as big. Old tables are
+// kept alive, so readers still probing them stay safe; a reader that misses
+// in a stale table just falls through to the locked slow path.
+struct InstrumentDirectory {
+  struct Slot {
+    uint64_t key;
+    std::atomic<InstrumentNew *> instrument{nullptr};
+  };
+
+  struct Table {
+    uint32_t mask;
+    std::unique_ptr<Slot[]> slots;
+
+    explicit Table(uint32_t capacity)
+        : mask{capacity - 1}, slots{std::make_unique<Slot[]>(capacity)} {}
+
+    static uint32_t hash(uint64_t key) {
+      return static_cast<uint32_t>((key * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+
+    InstrumentNew *find(uint64_t key) const {
+      for (auto i = hash(key) & mask;; i = (i + 1) & mask) {
+        auto *instrument = slots[i].instrument.load(std::memory_order_acquire);
+        if (!instrument) {
+          return nullptr;
+        }
+        if (slots[i].key == key) {
+          return instrument;
+        }
+      }
+    }
+
+    // Only called with the directory mutex held.
+    void insert(uint64_t key, InstrumentNew *instrument) {
+      auto i = hash(key) & mask;
+      while (slots[i].instrument.load(std::memory_order_relaxed)) {
+        i = (i + 1) & mask;
+      }
+      slots[i].key = key;
+      slots[i].instrument.store(instrument, std::memory_order_release);
+    }
+  };
+
+  static constexpr uint32_t INITIAL_CAPACITY = 1024;
+
+  std::atomic<Table *> table;
+
+  // Everything below is guarded by mtx.
+  std::mutex mtx;
+  std::vector<std::unique_ptr<Table>> tables;
+  std::vector<std::unique_ptr<InstrumentNew>> instruments;
+
+  InstrumentDirectory() {
+    tables.push_back(std::make_unique<Table>(INITIAL_CAPACITY));
+    table.store(tables.back().get(), std::memory_order_relaxed);
+  }
+
+  InstrumentNew *find(uint64_t key) const {
+    return table.load(std::memory_order_acquire)->find(key);
+  }
+
+  // Returns the instrument for key, creating it with make() on first use.
+  template <typename Factory>
+  InstrumentNew &findOrCreate(uint64_t key, Factory &&make) {
+    if (auto *instrument = find(key)) {
+      return *instrument;
+    }
+
+    std::lock_guard lock{mtx};
+    auto *current = table.load(std::memory_order_relaxed);
+    if (auto *instrument = current->find(key)) {
+      return *instrument;
+    }
+
+    instruments.push_back(make());
+    auto *instrument = instruments.back().get();
+    // Keep the load factor at or below a half so probes stay short.
+    if (instruments.size() * 2 > current->mask + 1u) {
+      auto grown = std::make_unique<Table>((current->mask + 1u) * 2);
+      for (uint32_t i = 0; i <= current->mask; ++i) {
+        if (auto *existing =
+                current->slots[i].instrument.load(std::memory_order_relaxed)) {
+          grown->insert(current->slots[i].key, existing);
+        }
+      }
+      grown->insert(key, instrument);
+      tables.push_back(std::move(grown));
+      table.store(tables.back().get(), std::memory_order_release);
+    } else {
+      current->insert(key, instrument);
+    }
+    return *instrument;
+  }
+
+  template <typename Fn> void forEach(Fn &&fn) {
+    std::lock_guard lock{mtx};
+    for (auto &instrument : instruments) {
+      fn(*instrument);
+    }
+  }
+};
@@ -1,18 +1,29 @@
 // This file contains definitions used by the provided I/O code.
-// There should be no need to modify this file.
 
 #pragma once
 
+#include <memory>
 #include <mutex>
 #include <utility>
 #include <cstdint>
 #include <iostream>
 
+#include "event_clock.hpp"
+
 enum CommandType
 {
 	input_buy = 'B',
 	input_sell = 'S',
-	input_cancel = 'C'
+	input_cancel = 'C',
+	// Changes the price and count of a resting order; see
+	// InstrumentNew::handleAmendOrder(). The instrument is not used.
+	input_amend = 'A',
+	// Buys and sells that never rest. Immediate-or-cancel drops whatever
+	// does not execute at once; fill-or-kill executes in full or not at all.
+	input_buy_ioc = 'B' | 'I' << 8,
+	input_sell_ioc = 'S' | 'I' << 8,
+	input_buy_fok = 'B' | 'F' << 8,
+	input_sell_fok = 'S' | 'F' << 8
 };
 
 struct ClientCommand
@@ -24,19 +35,56 @@ struct ClientCommand
 	char instrument[9];
 };
 
+// Framed protocol, version 1: a FrameHeader followed by count packed
+// ClientCommands, which the engine handles as one unit. The magic is never
+// the type of a ClientCommand, so framed and plain commands can be mixed on
+// one connection.
+struct FrameHeader
+{
+	static constexpr uint32_t MAGIC = 'F' | 'R' << 8 | 'A' << 16 | 'M' << 24;
+	static constexpr uint16_t VERSION = 1;
+	static constexpr uint16_t MAX_COMMANDS = 128;
+
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;
+};
+
+constexpr size_t MAX_FRAME_BYTES = sizeof(FrameHeader) + FrameHeader::MAX_COMMANDS * sizeof(ClientCommand);
+
+// Decodes the next unit of the input in [data, data + size): a whole frame,
+// or a run of plain commands up to the next frame. Its commands are copied to
+// commands, which must have room for a whole frame if one is next.
+// Returns the bytes the unit took up, 0 if no unit has fully arrived yet, or
+// SIZE_MAX if the input is malformed. count can be 0 for an empty frame.
+size_t decodeCommands(const char* data, size_t size, ClientCommand* commands, size_t max_count, size_t& count);
+
 enum class ReadResult
 {
 	Success,
 	EndOfFile,
-	Error
+	Error,
+	// Only for non-blocking handles: nothing has arrived yet.
+	WouldBlock
 };
 
+// A client socket with a per-connection receive buffer. Each read() pulls in
+// as many bytes as are available, commands are handed out of the buffer, and
+// a command or frame split across reads is reassembled from the pieces.
 struct ClientConnection
 {
+	static constexpr size_t BUFFER_COMMANDS = FrameHeader::MAX_COMMANDS;
+
 	~ClientConnection() { this->freeHandle(); }
-	explicit ClientConnection(int handle) : m_handle(handle) { }
+	explicit ClientConnection(int handle) : m_handle(handle), m_buffer(new char[BUFFER_SIZE]) { }
 
-	ClientConnection(ClientConnection&& other) : m_handle(std::exchange(other.m_handle, -1)) { }
+	ClientConnection(ClientConnection&& other)
+	    : m_handle(std::exchange(other.m_handle, -1))
+	    , m_buffer(std::move(other.m_buffer))
+	    , m_begin(std::exchange(other.m_begin, 0))
+	    , m_end(std::exchange(other.m_end, 0))
+	{
+	}
 	ClientConnection& operator=(ClientConnection&& other)
 	{
 		if(&other == this)
@@ -44,6 +92,9 @@ struct ClientConnection
 
 		this->freeHandle();
 		m_handle = std::exchange(other.m_handle, -1);
+		m_buffer = std::move(other.m_buffer);
+		m_begin = std::exchange(other.m_begin, 0);
+		m_end = std::exchange(other.m_end, 0);
 
 		return *this;
 	}
@@ -53,9 +104,32 @@ struct ClientConnection
 
 	ReadResult readInput(ClientCommand& read_into);
 
+	// Fills commands with the next unit of input (see decodeCommands()): the
+	// commands of one frame, or up to max_count plain ones. A unit already
+	// buffered is returned without a syscall; otherwise this reads once, or
+	// again only while what has arrived is less than one whole unit.
+	// On Success, count is at least 1. Framed input fails unless max_count
+	// is at least FrameHeader::MAX_COMMANDS.
+	ReadResult readBatch(ClientCommand* commands, size_t max_count, size_t& count);
+
+	// Whether a whole unit is buffered, so that readBatch() returns it
+	// without reading.
+	bool hasBuffered() const;
+
+	int handle() const { return m_handle; }
+
 private:
+	static constexpr size_t BUFFER_SIZE = MAX_FRAME_BYTES;
+
 	int m_handle;
+	// Unconsumed bytes are m_buffer[m_begin, m_end).
+	std::unique_ptr<char[]> m_buffer;
+	size_t m_begin = 0;
+	size_t m_end = 0;
+
 	void freeHandle();
+	size_t buffered() const { return m_end - m_begin; }
+	ReadResult fill();
 };
 
 // An implementation of std::osyncstream{std::cout}
@@ -100,47 +174,70 @@ struct SyncCerr
 	}
 };
 
+enum class OutputMode
+{
+	// Format and write every event under SyncCout, as the reference engine does.
+	Sync,
+	// Queue events in per-thread buffers and let a writer thread format and
+	// write them in batches.
+	Async,
+	// Drop events; timestamps are still taken. Used for benchmarks.
+	Discard,
+	// Like Async, but the writer thread writes compact binary records
+	// instead of text; see binary_output.hpp.
+	Binary
+};
+
+// Output events. Each function takes its timestamp from the given clock only
+// once the event has a place in the output stream, so the printed timestamps
+// are increasing in output order. The text format is the same in every mode
+// but Binary.
 class Output
 {
 public:
-	inline static void
-	OrderAdded(uint32_t id, const char* symbol, uint32_t price, uint32_t count, bool is_sell_side, intmax_t output_timestamp)
+	// Selects the mode and the file descriptor written to. Must be called before
+	// the first event.
+	static void configure(OutputMode mode, int fd = 1);
+
+	// Writes out all events produced so far. Registered with atexit().
+	static void flush();
+
+	// Defers what each event does to get it written, i.e. wake the writer
+	// thread in Async mode and flush stdout in Sync mode, while one is alive
+	// on the calling thread: a batch of commands then pays for it once.
+	struct Batch
 	{
-		SyncCout()
-		    << (is_sell_side ? "S " : "B ") //
-		    << id << " "                    //
-		    << symbol << " "                //
-		    << price << " "                 //
-		    << count << " "                 //
-		    << output_timestamp             //
-		    << std::endl;
-	}
+		Batch();
+		~Batch();
+		Batch(const Batch&) = delete;
+		Batch& operator=(const Batch&) = delete;
+	};
+
+	static void OrderAdded(uint32_t id,
+	    const char* symbol,
+	    uint32_t price,
+	    uint32_t count,
+	    bool is_sell_side,
+	    EventClock& clock);
 
-	inline static void OrderExecuted(uint32_t resting_id,
+	static void OrderExecuted(uint32_t resting_id,
 	    uint32_t new_id,
 	    uint32_t execution_id,
 	    uint32_t price,
 	    uint32_t count,
-	    intmax_t output_timestamp)
-	{
-		SyncCout()
-		    << "E "                //
-		    << resting_id << " "   //
-		    << new_id << " "       //
-		    << execution_id << " " //
-		    << price << " "        //
-		    << count << " "        //
-		    << output_timestamp    //
-		    << std::endl;
-	}
+	    EventClock& clock);
 
-	inline static void OrderDeleted(uint32_t id, bool cancel_accepted, intmax_t output_timestamp)
-	{
-		SyncCout()
-		    << "X "                            //
-		    << id << " "                       //
-		    << (cancel_accepted ? "A " : "R ") //
-		    << output_timestamp                //
-		    << std::endl;
-	}
+	static void OrderDeleted(uint32_t id, bool cancel_accepted, EventClock& clock);
+
+	// "M <id> <price> <count> A|R <timestamp>": an amend of order id to price
+	// and count was accepted or rejected.
+	static void OrderAmended(uint32_t id,
+	    uint32_t price,
+	    uint32_t count,
+	    bool amend_accepted,
+	    EventClock& clock);
+
+	// "K <id> <count> <timestamp>": count of an immediate-or-cancel or
+	// fill-or-kill order id did not execute and was dropped.
+	static void OrderKilled(uint32_t id, uint32_t count, EventClock& clock);
 };
@@ -0,0 +1,300 @@
+// Compares the engine's client I/O backends end to end.
+//
+// Build with `make iobench` and run `./iobench [connections] [orders]`. For
+// each backend this starts ./engine, streams pre-encoded orders over the
+// given number of connections and waits until every order has been echoed on
+// the engine's stdout. Each backend is run twice: once untraced for
+// throughput, and once under ptrace to count the syscalls the engine makes
+// while ingesting the same load.
+//
+// The orders are all buys, so none of them match and each produces exactly
+// one output line.
+//
+// The shm backend hands the orders over shared-memory rings instead (see
+// shm_transport.hpp), one region per connection.
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io.hpp"
+#include "shm_transport.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Backend {
+  const char *name;
+  std::vector<const char *> env;
+  bool shm = false;
+};
+
+struct Result {
+  double seconds = 0;
+  // Syscall number -> count; only filled by traced runs.
+  std::map<long, uint64_t> syscalls;
+};
+
+const char *const SOCKET_PATH = "/tmp/iobench.sock";
+const char *const SHM_SOCKET_PATH = "/tmp/iobench-shm.sock";
+
+pid_t spawnEngine(const Backend &backend, int stdout_fd, bool traced) {
+  auto pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+  dup2(stdout_fd, 1);
+  for (auto *assignment : backend.env) {
+    putenv(const_cast<char *>(assignment));
+  }
+  putenv(const_cast<char *>("ENGINE_OUTPUT=async"));
+  putenv(const_cast<char *>("ENGINE_SHM_SOCKET=/tmp/iobench-shm.sock"));
+  if (traced) {
+    ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+    raise(SIGSTOP);
+  }
+  execl("./engine", "./engine", SOCKET_PATH, nullptr);
+  perror("exec ./engine");
+  _exit(1);
+}
+
+int connectEngine() {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, SOCKET_PATH, sizeof(address.sun_path) - 1);
+  while (true) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) ==
+        0) {
+      return fd;
+    }
+    close(fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+}
+
+ShmRegion *connectShmEngine(int &fd) {
+  // The engine listens on the shared-memory socket before the regular one.
+  close(connectEngine());
+  return connectShm(SHM_SOCKET_PATH, fd);
+}
+
+// Pushes the commands in data onto the region's ring, draining the engine's
+// responses as it goes.
+void pushAll(ShmRegion &region, const char *data, size_t size) {
+  auto *commands = reinterpret_cast<const ClientCommand *>(data);
+  auto count = size / sizeof(ClientCommand);
+  ShmResponse responses[256];
+  for (size_t pushed = 0; pushed < count;) {
+    auto n = region.commands.tryPush(commands + pushed, count - pushed);
+    while (region.responses.tryPop(responses, std::size(responses))) {
+    }
+    if (!n) {
+      std::this_thread::yield();
+    }
+    pushed += n;
+  }
+}
+
+void writeAll(int fd, const char *data, size_t size) {
+  while (size) {
+    auto written = write(fd, data, size);
+    if (written <= 0) {
+      perror("write");
+      exit(1);
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+// Follows the engine and all its threads, counting syscall entries until the
+// engine exits.
+void traceSyscalls(pid_t engine, std::map<long, uint64_t> &syscalls) {
+  int status;
+  waitpid(engine, &status, 0); // the SIGSTOP before exec
+  ptrace(PTRACE_SETOPTIONS, engine, nullptr,
+         PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+  ptrace(PTRACE_SYSCALL, engine, nullptr, nullptr);
+  while (true) {
+    auto tid = waitpid(-1, &status, __WALL);
+    if (tid == -1) {
+      return;
+    }
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (tid == engine) {
+        return;
+      }
+      continue;
+    }
+    int deliver = 0;
+    auto signal = WSTOPSIG(status);
+    if (signal == (SIGTRAP | 0x80)) {
+      __ptrace_syscall_info info;
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0 &&
+          info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        ++syscalls[static_cast<long>(info.entry.nr)];
+      }
+    } else if (signal != SIGTRAP && signal != SIGSTOP) {
+      // A real signal, e.g. the SIGTERM that ends the run.
+      deliver = signal;
+    }
+    ptrace(PTRACE_SYSCALL, tid, nullptr, deliver);
+  }
+}
+
+Result run(const Backend &backend, const std::vector<std::string> &streams,
+           size_t expected_lines, bool traced) {
+  unlink(SOCKET_PATH);
+  unlink(SHM_SOCKET_PATH);
+  int output[2];
+  if (pipe(output) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+  auto engine = spawnEngine(backend, output[1], traced);
+  close(output[1]);
+
+  Result result;
+  std::thread driver{[&] {
+    std::vector<int> fds;
+    std::vector<ShmRegion *> regions;
+    for (size_t i = 0; i < streams.size(); ++i) {
+      if (backend.shm) {
+        int fd;
+        auto *region = connectShmEngine(fd);
+        if (!region) {
+          exit(1);
+        }
+        regions.push_back(region);
+        fds.push_back(fd);
+      } else {
+        fds.push_back(connectEngine());
+      }
+    }
+    auto start = Clock::now();
+    std::vector<std::thread> writers;
+    for (size_t i = 0; i < streams.size(); ++i) {
+      writers.emplace_back([&, i] {
+        if (backend.shm) {
+          pushAll(*regions[i], streams[i].data(), streams[i].size());
+        } else {
+          writeAll(fds[i], streams[i].data(), streams[i].size());
+        }
+      });
+    }
+
+    char buffer[1 << 16];
+    size_t lines = 0;
+    while (lines < expected_lines) {
+      auto bytes = read(output[0], buffer, sizeof(buffer));
+      if (bytes <= 0) {
+        fprintf(stderr, "%s: engine output ended after %zu lines\n",
+                backend.name, lines);
+        break;
+      }
+      lines += static_cast<size_t>(
+          std::count(buffer, buffer + bytes, '\n'));
+    }
+    result.seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    for (auto &writer : writers) {
+      writer.join();
+    }
+    for (auto fd : fds) {
+      close(fd);
+    }
+    for (auto *region : regions) {
+      munmap(region, sizeof(ShmRegion));
+    }
+    kill(engine, SIGTERM);
+  }};
+
+  if (traced) {
+    traceSyscalls(engine, result.syscalls);
+  }
+  driver.join();
+  waitpid(engine, nullptr, 0);
+  close(output[0]);
+  unlink(SOCKET_PATH);
+  unlink(SHM_SOCKET_PATH);
+  return result;
+}
+
+uint64_t count(const std::map<long, uint64_t> &syscalls,
+               std::initializer_list<long> numbers) {
+  uint64_t total = 0;
+  for (auto number : numbers) {
+    if (auto it = syscalls.find(number); it != syscalls.end()) {
+      total += it->second;
+    }
+  }
+  return total;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t connections = argc > 1 ? strtoul(argv[1], nullptr, 10) : 4;
+  size_t orders = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1u << 18;
+
+  // Connection c sends orders c, c + connections, ...
+  std::vector<std::string> streams(connections);
+  for (size_t i = 0; i < orders; ++i) {
+    ClientCommand command{};
+    command.type = input_buy;
+    command.order_id = static_cast<uint32_t>(i);
+    command.price = static_cast<uint32_t>(1000 + i % 64);
+    command.count = 1;
+    strcpy(command.instrument, "BENCH");
+    streams[i % connections].append(reinterpret_cast<const char *>(&command),
+                                    sizeof(command));
+  }
+
+  std::vector<Backend> backends = {
+      {"blocking", {}},
+      {"epoll", {"ENGINE_IO_THREADS=1"}},
+      {"io_uring", {"ENGINE_IO_URING=1"}},
+      {"shm", {}, true},
+  };
+
+  printf("connections: %zu, orders: %zu\n", connections, orders);
+  printf("%-10s %12s %10s %10s %10s %10s %10s\n", "backend", "orders/s",
+         "syscalls", "per order", "read", "write", "wait");
+  for (auto &backend : backends) {
+    auto timed = run(backend, streams, orders, false);
+    auto traced = run(backend, streams, orders, true);
+    uint64_t total = 0;
+    for (auto &[number, calls] : traced.syscalls) {
+      total += calls;
+    }
+    printf("%-10s %12.0f %10llu %10.3f %10llu %10llu %10llu\n", backend.name,
+           static_cast<double>(orders) / timed.seconds,
+           static_cast<unsigned long long>(total),
+           static_cast<double>(total) / static_cast<double>(orders),
+           static_cast<unsigned long long>(
+               count(traced.syscalls, {SYS_read, SYS_recvfrom, SYS_recvmsg})),
+           static_cast<unsigned long long>(
+               count(traced.syscalls, {SYS_write, SYS_writev, SYS_sendmsg})),
+           static_cast<unsigned long long>(
+               count(traced.syscalls, {SYS_epoll_wait, SYS_epoll_pwait,
+                                       SYS_io_uring_enter, SYS_futex})));
+  }
+  return 0;
+}
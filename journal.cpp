@@ -0,0 +1,200 @@
+#include "journal.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "order_book.hpp"
+
+namespace {
+
+Journal *exit_journal = nullptr;
+
+// A record with every byte defined, so records compare equal and replay the
+// same way whatever the client left in the padding.
+ClientCommand record(CommandType type, uint32_t order_id, uint32_t price,
+                     uint32_t count, std::string_view instrument) {
+  ClientCommand record;
+  memset(&record, 0, sizeof(record));
+  record.type = type;
+  record.order_id = order_id;
+  record.price = price;
+  record.count = count;
+  instrument.copy(record.instrument,
+                  std::min(instrument.size(), sizeof(record.instrument) - 1));
+  return record;
+}
+
+} // namespace
+
+Journal::Journal(const char *path, size_t _batch_bytes, unsigned interval_us)
+    : fd{open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)},
+      batch_bytes{std::max(_batch_bytes, sizeof(ClientCommand))},
+      interval{interval_us}, ring{QUEUE} {
+  struct stat status;
+  if (fd == -1 || fstat(fd, &status) != 0) {
+    SyncCerr{} << "journal: cannot open " << path << ": " << strerror(errno)
+               << std::endl;
+    exit(1);
+  }
+  // Drop a record torn by a crash, so that appends stay aligned.
+  auto size = static_cast<size_t>(status.st_size);
+  if (size % sizeof(ClientCommand)) {
+    if (ftruncate(fd, static_cast<off_t>(size - size % sizeof(ClientCommand)))) {
+      SyncCerr{} << "journal: cannot truncate " << path << ": "
+                 << strerror(errno) << std::endl;
+      exit(1);
+    }
+  }
+  base = committed = size / sizeof(ClientCommand);
+  batch.reserve(batch_bytes / sizeof(ClientCommand));
+  std::thread(&Journal::run, this).detach();
+  exit_journal = this;
+  atexit([] { exit_journal->flush(); });
+}
+
+void Journal::append(CommandType type, uint32_t order_id, uint32_t price,
+                     uint32_t count, std::string_view instrument) {
+  ring.push(record(type, order_id, price, count, instrument));
+}
+
+bool Journal::drain() {
+  auto capacity = batch_bytes / sizeof(ClientCommand);
+  ClientCommand command;
+  while (batch.size() < capacity && ring.tryPop(command)) {
+    if (batch.empty()) {
+      oldest = std::chrono::steady_clock::now();
+    }
+    batch.push_back(command);
+  }
+  return batch.size() >= capacity;
+}
+
+void Journal::commit() {
+  auto *data = reinterpret_cast<const char *>(batch.data());
+  auto size = batch.size() * sizeof(ClientCommand);
+  while (size) {
+    auto written = write(fd, data, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      SyncCerr{} << "journal: write failed: " << strerror(errno) << std::endl;
+      exit(1);
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+  if (!batch.empty() && fdatasync(fd) != 0) {
+    SyncCerr{} << "journal: fdatasync failed: " << strerror(errno)
+               << std::endl;
+    exit(1);
+  }
+  committed += batch.size();
+  batch.clear();
+}
+
+void Journal::flush() {
+  std::lock_guard lock{commit_mtx};
+  while (drain()) {
+    commit();
+  }
+  commit();
+}
+
+void Journal::sync(uint64_t position) {
+  while (true) {
+    {
+      std::lock_guard lock{commit_mtx};
+      while (drain()) {
+        commit();
+      }
+      commit();
+      if (committed >= position) {
+        return;
+      }
+    }
+    // The ring stops at a record still being appended.
+    std::this_thread::yield();
+  }
+}
+
+void Journal::run() {
+  while (true) {
+    {
+      std::lock_guard lock{commit_mtx};
+      bool full = drain();
+      if (full || (!batch.empty() &&
+                   std::chrono::steady_clock::now() - oldest >= interval)) {
+        commit();
+        continue;
+      }
+    }
+    if (batch.empty()) {
+      ring.waitForWork();
+    } else {
+      // Let more commands join the batch before its deadline.
+      std::this_thread::sleep_for(
+          std::min(interval, std::chrono::microseconds{50}));
+    }
+  }
+}
+
+long replayJournal(OrderBookNew &book, const char *path,
+                   const ReplayStart &start) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    return -1;
+  }
+  auto count = static_cast<size_t>(status.st_size) / sizeof(ClientCommand);
+  if (!count) {
+    close(fd);
+    return 0;
+  }
+  auto size = count * sizeof(ClientCommand);
+  auto *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return -1;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  auto *commands = static_cast<const ClientCommand *>(data);
+  long run = 0;
+  for (size_t i = 0; i < count; ++i) {
+    auto &command = commands[i];
+    bool reject = !command.instrument[0] && (command.type == input_cancel ||
+                                             command.type == input_amend);
+    if (start.journaled) {
+      auto from = start.rejects;
+      if (!reject) {
+        auto instrument =
+            start.instruments.find(packSymbol(command.instrument));
+        from = instrument == start.instruments.end() ? 0 : instrument->second;
+      }
+      if (i < from) {
+        continue;
+      }
+    }
+    ++run;
+    if (!reject) {
+      book.processCommand(command);
+    } else if (command.type == input_cancel) {
+      book.rejectCancel(command.order_id);
+    } else {
+      book.rejectAmend(command.order_id, command.price, command.count);
+    }
+  }
+  munmap(data, size);
+  return run;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+// Append-only journal of every command the engine runs, for audit and
+// recovery.
+//
+// The journal file is a plain array of ClientCommand records in the wire
+// layout (with the padding and instrument tail zeroed), so it can be mapped
+// and replayed without parsing, or sent to the engine as is. A record torn by
+// a crash is cut off when the journal is reopened.
+//
+// Commands are journaled where they run rather than where they arrive: each
+// instrument's commands are appended by whoever runs them, right after they
+// ran and before the next one starts (its matching worker, its combiner, or
+// in EngineMode::THREADED any thread holding its journal_lk, which then
+// serialises its commands). Replaying the journal in order thus runs every
+// instrument's commands in the order they ran live. Cancels and amends are
+// recorded with the instrument they ran on; those of orders the index did not
+// know are recorded without one and replayed as rejects without a lookup, as
+// the lookup raced with commands of other connections.
+//
+// Matching threads only push commands onto a ring. A writer thread does
+// group commit: it drains the ring into a batch and writes and fdatasync()s
+// the batch once it holds batch_bytes, or once its oldest command has waited
+// interval_us, or whenever the ring runs dry if interval_us is 0. The journal
+// is therefore durable up to the last commit, which trails matching by at
+// most about one interval.
+//
+// A record's position is its index in the file. A snapshot stores, for each
+// instrument, the position the journal had reached when the instrument was
+// captured, so that a replay on top of the snapshot only runs the records
+// after it; see ReplayStart.
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "io.hpp"
+#include "mpsc_ring.hpp"
+
+struct OrderBookNew;
+
+struct Journal {
+  // Commands the ring holds before append() has to wait for the writer.
+  static constexpr unsigned QUEUE = 1u << 16;
+
+  int fd;
+  // Records the file held when opened.
+  uint64_t base = 0;
+  size_t batch_bytes;
+  std::chrono::microseconds interval;
+
+  MpscRing<ClientCommand> ring;
+  // Serialises commits between the writer thread and flush().
+  std::mutex commit_mtx;
+  std::vector<ClientCommand> batch;
+  std::chrono::steady_clock::time_point oldest;
+  // Records in the file, up to the last commit. Guarded by commit_mtx.
+  uint64_t committed = 0;
+
+  // Opens path for appending, creating it if needed. Exits if that fails.
+  Journal(const char *path, size_t batch_bytes, unsigned interval_us);
+
+  // Called by matching threads once a command has run. instrument is the
+  // one it ran on, or empty for a reject of an unknown order.
+  void append(CommandType type, uint32_t order_id, uint32_t price,
+              uint32_t count, std::string_view instrument);
+
+  // Position of the next record appended. Every record appended before the
+  // call comes before it in the file, and every record appended after it
+  // comes after.
+  uint64_t position() const {
+    return base + ring.enqueue_pos.load(std::memory_order_acquire);
+  }
+
+  // Commits everything appended so far; registered to run at exit.
+  void flush();
+
+  // Returns once the records before position are committed, including those
+  // other threads are still in the middle of appending.
+  void sync(uint64_t position);
+
+  void run();
+
+private:
+  // Moves commands from the ring into the batch until it is full or the
+  // ring is empty. Returns whether the batch is full.
+  bool drain();
+  void commit();
+};
+
+// Where a replay of a journal starts when the book was restored from a
+// snapshot taken while writing that journal.
+struct ReplayStart {
+  // Whether the snapshot recorded journal positions at all.
+  bool journaled = false;
+  // Rejects of unknown orders before this position are skipped.
+  uint64_t rejects = 0;
+  // Each instrument's records before its position here, by packed symbol,
+  // are skipped: the snapshot holds their effects. Instruments not listed
+  // start at 0.
+  std::unordered_map<uint64_t, uint64_t> instruments;
+};
+
+// Feeds the commands of the journal at path into book, in order, on the
+// calling thread, skipping those start says the book already holds; cancels
+// and amends recorded without an instrument are rejected as they were live.
+// Output goes wherever Output is configured. Returns the number of commands
+// run, or -1 if path can't be read.
+long replayJournal(OrderBookNew &book, const char *path,
+                   const ReplayStart &start = {});
@@ -0,0 +1,412 @@
+// Load generator and latency recorder.
+//
+//   make loadgen
+//   ./loadgen [-c connections] [-r commands/s] [-f commands/frame]
+//             [-e engine] <testcase.in>
+//
+// Reads a testcase in the grader's format and pre-encodes each client
+// thread's commands into one array of ClientCommands. It then starts the
+// engine, replays the arrays over the connections and reads the engine's
+// stdout until the output stays quiet. Engine settings are inherited from
+// the environment, e.g. ENGINE_MODE=sharded.
+//
+// Only commands are replayed. Barriers, sleeps and waits in the testcase
+// are ignored, so every connection streams open-loop. With -c, thread t
+// sends on connection t % connections. -r paces the combined send rate,
+// spread evenly over the connections; without it every connection sends as
+// fast as the engine takes commands. -f sends each burst as frames of up to
+// that many commands (see FrameHeader) instead of plain commands.
+//
+// The latency of an output line is the time from writing the command that
+// caused it to reading the line, so it includes the engine's output
+// batching. Adds, executions and kills belong to the new order's command,
+// and cancel and amend results to the cancel or amend command.
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "client_command.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t MAX_BURST = 512;
+constexpr int QUIET_MS = 500;
+
+struct Options {
+  unsigned connections = 0; // 0: one per testcase thread
+  double rate = 0;          // 0: unpaced
+  unsigned frame_size = 0;  // 0: plain commands
+  const char *engine = "./engine";
+  const char *testcase = nullptr;
+};
+
+// One connection's commands and the time each was written.
+struct Stream {
+  std::vector<ClientCommand> commands;
+  std::unique_ptr<std::atomic<int64_t>[]> sent_ns;
+};
+
+int64_t nowNs(Clock::time_point origin) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              origin)
+      .count();
+}
+
+std::vector<Stream> loadTestcase(const Options &options) {
+  std::ifstream input{options.testcase};
+  if (!input) {
+    perror(options.testcase);
+    exit(1);
+  }
+  std::string line;
+  unsigned thread_count = 0;
+  while (std::getline(input, line)) {
+    if (!line.empty() && line[0] != '#') {
+      thread_count = static_cast<unsigned>(std::stoul(line));
+      break;
+    }
+  }
+  if (!thread_count) {
+    fprintf(stderr, "%s: missing thread count\n", options.testcase);
+    exit(1);
+  }
+
+  auto connections = options.connections ? options.connections : thread_count;
+  std::vector<Stream> streams(connections);
+  std::vector<unsigned> all_threads(thread_count);
+  for (unsigned thread = 0; thread < thread_count; ++thread) {
+    all_threads[thread] = thread;
+  }
+  while (std::getline(input, line)) {
+    std::vector<unsigned> threads;
+    const char *text = line.c_str();
+    auto space = line.find(' ');
+    if (space != std::string::npos && isdigit(line[0]) &&
+        parseThreadSpec(line.substr(0, space), threads)) {
+      text += space + 1;
+    } else {
+      threads = all_threads;
+    }
+    ClientCommand command;
+    switch (parseClientCommand(text, command)) {
+    case ParseResult::Command:
+      for (auto thread : threads) {
+        streams[thread % connections].commands.push_back(command);
+      }
+      break;
+    case ParseResult::InvalidCancel:
+    case ParseResult::InvalidNew:
+    case ParseResult::InvalidAmend:
+      fprintf(stderr, "Invalid command: %s\n", line.c_str());
+      exit(1);
+    default:
+      // Blank lines, comments and the grader's o/x/./s/w directives.
+      break;
+    }
+  }
+  for (auto &stream : streams) {
+    stream.sent_ns =
+        std::make_unique<std::atomic<int64_t>[]>(stream.commands.size());
+  }
+  return streams;
+}
+
+pid_t spawnEngine(const Options &options, const char *socket_path,
+                  int stdout_fd) {
+  auto pid = fork();
+  if (pid == 0) {
+    dup2(stdout_fd, 1);
+    execl(options.engine, options.engine, socket_path, nullptr);
+    perror(options.engine);
+    _exit(1);
+  }
+  return pid;
+}
+
+int connectEngine(const char *socket_path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+  for (int attempt = 0; attempt < 500; ++attempt) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) ==
+        0) {
+      return fd;
+    }
+    close(fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+  fprintf(stderr, "Could not connect to %s\n", socket_path);
+  exit(1);
+}
+
+// Writes the stream, in bursts of at most MAX_BURST commands. When paced,
+// each burst is what has fallen due since the start.
+void sendStream(int fd, Stream &stream, double rate, unsigned frame_size,
+                Clock::time_point origin) {
+  auto *data = stream.commands.data();
+  std::vector<char> frames;
+  size_t sent = 0;
+  while (sent < stream.commands.size()) {
+    auto now = nowNs(origin);
+    auto due = stream.commands.size();
+    if (rate > 0) {
+      due = std::min(due, static_cast<size_t>(static_cast<double>(now) * rate /
+                                              1e9) + 1);
+      if (due <= sent) {
+        std::this_thread::sleep_for(std::chrono::microseconds{20});
+        continue;
+      }
+    }
+    auto burst = std::min(due - sent, MAX_BURST);
+    for (size_t i = sent; i < sent + burst; ++i) {
+      stream.sent_ns[i].store(now, std::memory_order_relaxed);
+    }
+    auto *bytes = reinterpret_cast<const char *>(data + sent);
+    auto size = burst * sizeof(ClientCommand);
+    if (frame_size) {
+      frames.clear();
+      for (size_t i = 0; i < burst; i += frame_size) {
+        auto count =
+            static_cast<uint16_t>(std::min<size_t>(frame_size, burst - i));
+        FrameHeader header{FrameHeader::MAGIC, FrameHeader::VERSION, count};
+        auto *header_bytes = reinterpret_cast<const char *>(&header);
+        frames.insert(frames.end(), header_bytes,
+                      header_bytes + sizeof(header));
+        frames.insert(frames.end(), bytes + i * sizeof(ClientCommand),
+                      bytes + (i + count) * sizeof(ClientCommand));
+      }
+      bytes = frames.data();
+      size = frames.size();
+    }
+    while (size) {
+      auto written = write(fd, bytes, size);
+      if (written <= 0) {
+        perror("write");
+        exit(1);
+      }
+      bytes += written;
+      size -= static_cast<size_t>(written);
+    }
+    sent += burst;
+  }
+}
+
+struct Latencies {
+  // Output kind ('B', 'S', 'E', 'X', 'M' or 'K') -> latencies in ns.
+  std::map<char, std::vector<int64_t>> by_kind;
+  size_t lines = 0;
+  size_t unmatched = 0;
+  int64_t last_line_ns = 0;
+};
+
+// Where to find the send time of the command an output line belongs to.
+struct CommandRef {
+  uint32_t stream;
+  uint32_t index;
+};
+
+struct Recorder {
+  std::vector<Stream> &streams;
+  std::unordered_map<uint32_t, CommandRef> orders;
+  std::unordered_map<uint32_t, CommandRef> cancels;
+  std::unordered_map<uint32_t, CommandRef> amends;
+  Latencies latencies;
+
+  explicit Recorder(std::vector<Stream> &_streams) : streams{_streams} {
+    for (uint32_t s = 0; s < streams.size(); ++s) {
+      auto &commands = streams[s].commands;
+      for (uint32_t i = 0; i < commands.size(); ++i) {
+        auto type = commands[i].type;
+        auto &index = type == input_cancel  ? cancels
+                      : type == input_amend ? amends
+                                            : orders;
+        index[commands[i].order_id] = {s, i};
+      }
+    }
+  }
+
+  void record(const char *line, int64_t now) {
+    ++latencies.lines;
+    latencies.last_line_ns = now;
+    // B/S/K <id> ..., E <resting> <new> ..., X <id> ..., M <id> ...
+    unsigned first = 0, second = 0;
+    auto kind = line[0];
+    auto fields = sscanf(line + 1, " %u %u", &first, &second);
+    auto &index = kind == 'X' ? cancels : kind == 'M' ? amends : orders;
+    auto id = kind == 'E' ? second : first;
+    auto it = index.find(id);
+    if (fields < (kind == 'E' ? 2 : 1) || it == index.end()) {
+      ++latencies.unmatched;
+      return;
+    }
+    auto sent = streams[it->second.stream].sent_ns[it->second.index].load(
+        std::memory_order_relaxed);
+    latencies.by_kind[kind].push_back(now - sent);
+  }
+
+  // Reads output lines until none arrive for QUIET_MS after sending is done.
+  void run(int fd, const std::atomic<bool> &sending, Clock::time_point origin) {
+    std::string pending;
+    char buffer[1 << 16];
+    pollfd poll_fd{fd, POLLIN, 0};
+    while (true) {
+      auto ready = poll(&poll_fd, 1, QUIET_MS);
+      if (ready == 0) {
+        if (sending.load()) {
+          continue;
+        }
+        return;
+      }
+      auto bytes = read(fd, buffer, sizeof(buffer));
+      if (bytes <= 0) {
+        return;
+      }
+      auto now = nowNs(origin);
+      pending.append(buffer, static_cast<size_t>(bytes));
+      size_t start = 0;
+      for (auto end = pending.find('\n'); end != std::string::npos;
+           end = pending.find('\n', start)) {
+        pending[end] = '\0';
+        record(pending.c_str() + start, now);
+        start = end + 1;
+      }
+      pending.erase(0, start);
+    }
+  }
+};
+
+void report(const std::vector<Stream> &streams, const Latencies &latencies,
+            int64_t send_end_ns) {
+  size_t commands = 0;
+  for (auto &stream : streams) {
+    commands += stream.commands.size();
+  }
+  auto seconds = static_cast<double>(latencies.last_line_ns) / 1e9;
+  printf("connections: %zu, commands: %zu, output lines: %zu\n", streams.size(),
+         commands, latencies.lines);
+  printf("sent in %.3f s, last output at %.3f s: %.0f commands/s, %.0f "
+         "lines/s\n",
+         static_cast<double>(send_end_ns) / 1e9, seconds,
+         static_cast<double>(commands) / seconds,
+         static_cast<double>(latencies.lines) / seconds);
+  if (latencies.unmatched) {
+    printf("lines not matching any command: %zu\n", latencies.unmatched);
+  }
+  printf("%-6s %10s %10s %10s %10s %10s\n", "event", "count", "p50 us",
+         "p99 us", "p99.9 us", "max us");
+  for (auto &[kind, values] : latencies.by_kind) {
+    auto sorted = values;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) {
+      auto rank = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+      return static_cast<double>(sorted[rank]) / 1e3;
+    };
+    printf("%-6c %10zu %10.1f %10.1f %10.1f %10.1f\n", kind, sorted.size(),
+           percentile(0.5), percentile(0.99), percentile(0.999),
+           static_cast<double>(sorted.back()) / 1e3);
+  }
+}
+
+Options parseOptions(int argc, char *argv[]) {
+  Options options;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:r:f:e:")) != -1) {
+    switch (opt) {
+    case 'c':
+      options.connections = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+      break;
+    case 'r':
+      options.rate = strtod(optarg, nullptr);
+      break;
+    case 'f':
+      options.frame_size = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+      break;
+    case 'e':
+      options.engine = optarg;
+      break;
+    default:
+      optind = argc + 1;
+      break;
+    }
+  }
+  if (optind != argc - 1 || options.frame_size > FrameHeader::MAX_COMMANDS) {
+    fprintf(stderr,
+            "Usage: %s [-c connections] [-r commands/s] [-f commands/frame] "
+            "[-e engine] <testcase.in>\n",
+            argv[0]);
+    exit(1);
+  }
+  options.testcase = argv[optind];
+  return options;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  auto options = parseOptions(argc, argv);
+  auto streams = loadTestcase(options);
+
+  auto socket_path = "/tmp/loadgen-" + std::to_string(getpid()) + ".sock";
+  int output[2];
+  if (pipe(output) != 0) {
+    perror("pipe");
+    return 1;
+  }
+  auto engine = spawnEngine(options, socket_path.c_str(), output[1]);
+  close(output[1]);
+
+  std::vector<int> fds;
+  for (size_t i = 0; i < streams.size(); ++i) {
+    fds.push_back(connectEngine(socket_path.c_str()));
+  }
+
+  Recorder recorder{streams};
+  std::atomic<bool> sending{true};
+  std::atomic<int64_t> send_end_ns{0};
+  auto origin = Clock::now();
+  auto per_connection_rate = options.rate / static_cast<double>(streams.size());
+  std::vector<std::thread> senders;
+  for (size_t i = 0; i < streams.size(); ++i) {
+    senders.emplace_back([&, i] {
+      sendStream(fds[i], streams[i], per_connection_rate, options.frame_size,
+                 origin);
+    });
+  }
+  std::thread reader{[&] { recorder.run(output[0], sending, origin); }};
+  for (auto &sender : senders) {
+    sender.join();
+  }
+  send_end_ns = nowNs(origin);
+  sending = false;
+  reader.join();
+
+  for (auto fd : fds) {
+    close(fd);
+  }
+  kill(engine, SIGTERM);
+  waitpid(engine, nullptr, 0);
+  unlink(socket_path.c_str());
+  report(streams, recorder.latencies, send_end_ns.load());
+  return 0;
+}
@@ -1,5 +1,4 @@
 // This file contains main() as well as the logic setting up the I/O.
-// There should be no need to modify this file.
 
 #include <stdio.h>
 #include <signal.h>
@@ -11,10 +10,14 @@
 #include <unistd.h>
 
 #include "io.hpp"
+#include "config.hpp"
 #include "engine.hpp"
 
 static int listenfd = -1;
 static char* socketpath = NULL;
+// Only set when ENGINE_SHM_SOCKET is.
+static int shm_listenfd = -1;
+static const char* shm_socketpath = NULL;
 
 static void handle_exit_signal(int signum)
 {
@@ -30,6 +33,32 @@ static void exit_cleanup(void)
 	close(listenfd);
 	if(socketpath)
 		unlink(socketpath);
+	if(shm_listenfd != -1)
+	{
+		close(shm_listenfd);
+		unlink(shm_socketpath);
+	}
+}
+
+static int bind_socket(const char* path)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd == -1)
+	{
+		perror("socket");
+		return -1;
+	}
+
+	struct sockaddr_un sockaddr {};
+	sockaddr.sun_family = AF_UNIX;
+	strncpy(sockaddr.sun_path, path, sizeof(sockaddr.sun_path) - 1);
+	if(bind(fd, (const struct sockaddr*) &sockaddr, sizeof(sockaddr)) != 0)
+	{
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+	return fd;
 }
 
 int main(int argc, char* argv[])
@@ -41,35 +70,42 @@ int main(int argc, char* argv[])
 	}
 
 	socketpath = argv[1];
-	listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	listenfd = bind_socket(socketpath);
 	if(listenfd == -1)
-	{
-		perror("socket");
 		return 1;
-	}
 
+	atexit(exit_cleanup);
+	signal(SIGINT, handle_exit_signal);
+	signal(SIGTERM, handle_exit_signal);
+
+	auto config = EngineConfig::fromEnvironment();
+
+	// Co-located clients can come in over shared memory as well; see
+	// shm_transport.hpp.
+	if(!config.shm_socket.empty())
 	{
-		struct sockaddr_un sockaddr {};
-		sockaddr.sun_family = AF_UNIX;
-		strncpy(sockaddr.sun_path, argv[1], sizeof(sockaddr.sun_path) - 1);
-		if(bind(listenfd, (const struct sockaddr*) &sockaddr, sizeof(sockaddr)) != 0)
+		shm_socketpath = strdup(config.shm_socket.c_str());
+		shm_listenfd = bind_socket(shm_socketpath);
+		if(shm_listenfd == -1)
+			return 1;
+		if(listen(shm_listenfd, config.listen_backlog) != 0)
 		{
-			perror("bind");
+			perror("listen");
 			return 1;
 		}
 	}
 
-	atexit(exit_cleanup);
-	signal(SIGINT, handle_exit_signal);
-	signal(SIGTERM, handle_exit_signal);
-
-	if(listen(listenfd, 8) != 0)
+	// Last, so that whoever can connect here can reach the other socket too.
+	if(listen(listenfd, config.listen_backlog) != 0)
 	{
 		perror("listen");
 		return 1;
 	}
 
 	auto engine = new Engine();
+	if(shm_listenfd != -1)
+		engine->serveShm(shm_listenfd);
+	engine->serve(listenfd);
 	while(true)
 	{
 		int connfd = accept(listenfd, NULL, NULL);
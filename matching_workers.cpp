@@ -0,0 +1,162 @@
+#include <pthread.h>
+
+#include <thread>
+
+#include "instrument_directory.hpp"
+#include "matching_workers.hpp"
+
+MatchingWorkers::MatchingWorkers(OrderBookNew &_book,
+                                 const EngineConfig &config)
+    : book{_book} {
+  for (unsigned i = 0; i < config.workers; ++i) {
+    rings.push_back(std::make_unique<MpscRing<WorkerTask>>(config.worker_queue));
+  }
+  auto cpus = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned i = 0; i < config.workers; ++i) {
+    auto thread = std::thread(&MatchingWorkers::run, this, i);
+    if (config.pin_workers) {
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      CPU_SET(i % cpus, &cpuset);
+      pthread_setaffinity_np(thread.native_handle(), sizeof(cpuset), &cpuset);
+    }
+    thread.detach();
+  }
+}
+
+unsigned MatchingWorkers::workerOf(const InstrumentNew &instrument) const {
+  auto hash = packSymbol(instrument.name.c_str()) * 0x9E3779B97F4A7C15ull;
+  return static_cast<unsigned>((hash >> 32) % rings.size());
+}
+
+void MatchingWorkers::submit(const ClientCommand &command,
+                             InstrumentCache &cache) {
+  switch (command.type) {
+  case input_buy:
+  case input_sell:
+  case input_buy_ioc:
+  case input_sell_ioc:
+  case input_buy_fok:
+  case input_sell_fok: {
+    auto &instrument = book.ensureInstrumentExists(command.instrument, cache);
+    book.orders.assign(command.order_id, {&instrument, NULL_HANDLE,
+                                          isSellCommand(command.type)});
+    rings[workerOf(instrument)]->push({&instrument, command.order_id,
+                                       command.price, command.count,
+                                       command.type});
+    break;
+  }
+
+  case input_cancel: {
+    auto location = book.orders.find(command.order_id);
+    if (!location) {
+      book.rejectCancel(command.order_id);
+      break;
+    }
+    rings[workerOf(*location->instrument)]->push(
+        {location->instrument, command.order_id, 0, 0, input_cancel});
+    break;
+  }
+
+  case input_amend: {
+    auto location = book.orders.find(command.order_id);
+    if (!location) {
+      book.rejectAmend(command.order_id, command.price, command.count);
+      break;
+    }
+    rings[workerOf(*location->instrument)]->push(
+        {location->instrument, command.order_id, command.price, command.count,
+         input_amend});
+    break;
+  }
+  }
+}
+
+void MatchingWorkers::forEachInstrument(
+    const std::function<void(InstrumentNew &)> &fn) {
+  std::lock_guard lock{visit_mtx};
+  std::latch done{static_cast<std::ptrdiff_t>(rings.size())};
+  visit = &fn;
+  visited = &done;
+  for (auto &ring : rings) {
+    ring->push({nullptr, 0, 0, 0, input_buy});
+  }
+  done.wait();
+  visit = nullptr;
+  visited = nullptr;
+}
+
+void MatchingWorkers::journal(const WorkerTask &task) {
+  if (book.journal) {
+    book.journal->append(task.type, task.order_id, task.price, task.count,
+                         task.instrument->name);
+  }
+}
+
+void MatchingWorkers::run(unsigned worker) {
+  auto &ring = *rings[worker];
+  WorkerTask task;
+  while (true) {
+    if (!ring.tryPop(task)) {
+      ring.waitForWork();
+      continue;
+    }
+
+    if (!task.instrument) {
+      book.instruments.forEach([&](InstrumentNew &instrument) {
+        if (workerOf(instrument) == worker) {
+          (*visit)(instrument);
+        }
+      });
+      visited->count_down();
+      continue;
+    }
+
+    switch (task.type) {
+    case input_buy:
+    case input_sell:
+    case input_buy_ioc:
+    case input_sell_ioc:
+    case input_buy_fok:
+    case input_sell_fok: {
+      auto tif = timeInForceOf(task.type);
+      auto rested =
+          isSellCommand(task.type)
+              ? task.instrument->handleSellOrder<false>(
+                    task.order_id, task.price, task.count, tif)
+              : task.instrument->handleBuyOrder<false>(
+                    task.order_id, task.price, task.count, tif);
+      // Drop the routing entry submit() made for an order that never rested.
+      if (!rested) {
+        book.orders.erase(task.order_id);
+      }
+      journal(task);
+      break;
+    }
+
+    case input_cancel: {
+      // Look the order up again: by now it has either rested or gone.
+      auto location = book.orders.find(task.order_id);
+      if (!location) {
+        book.rejectCancel(task.order_id);
+        break;
+      }
+      task.instrument->handleCancelOrder<false>(task.order_id, *location);
+      journal(task);
+      break;
+    }
+
+    case input_amend: {
+      auto location = book.orders.find(task.order_id);
+      if (!location) {
+        book.rejectAmend(task.order_id, task.price, task.count);
+        break;
+      }
+      task.instrument->handleAmendOrder<false>(task.order_id, *location,
+                                               task.price, task.count);
+      journal(task);
+      break;
+    }
+    }
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <functional>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "config.hpp"
+#include "io.hpp"
+#include "mpsc_ring.hpp"
+#include "order_book.hpp"
+
+// A command after decoding, with its instrument already resolved. A null
+// instrument asks the worker to run MatchingWorkers::visit instead.
+struct WorkerTask {
+  InstrumentNew *instrument;
+  uint32_t order_id;
+  uint32_t price;
+  uint32_t count;
+  CommandType type;
+};
+
+// Single-writer matching for EngineMode::SHARDED.
+//
+// Instruments are partitioned across a fixed set of worker threads by their
+// packed symbol. A worker is the only thread that ever touches the books of
+// its instruments, so it runs the unlocked InstrumentNew paths. Connection
+// threads only decode commands and push them onto the owning worker's ring.
+//
+// Cancels and amends are routed through the order index: a buy or sell is
+// entered in the index (without a handle) before it is queued, so a cancel or
+// amend from the same connection always finds it and lands on the same
+// worker, behind it.
+struct MatchingWorkers {
+  OrderBookNew &book;
+  std::vector<std::unique_ptr<MpscRing<WorkerTask>>> rings;
+
+  // Set while forEachInstrument() runs.
+  std::mutex visit_mtx;
+  const std::function<void(InstrumentNew &)> *visit = nullptr;
+  std::latch *visited = nullptr;
+
+  MatchingWorkers(OrderBookNew &_book, const EngineConfig &config);
+
+  // Called by connection threads.
+  void submit(const ClientCommand &command, InstrumentCache &cache);
+
+  unsigned workerOf(const InstrumentNew &instrument) const;
+
+  // Runs fn on every instrument, on the worker that owns it and between two
+  // of its tasks, and returns once all are done. Each worker only pauses
+  // matching while it visits its own instruments.
+  void forEachInstrument(const std::function<void(InstrumentNew &)> &fn);
+
+  void run(unsigned worker);
+
+private:
+  // Journals a task that has just run, if the book is journaled.
+  void journal(const WorkerTask &task);
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+// Bounded multi-producer single-consumer ring (Vyukov's bounded queue).
+//
+// Each cell carries a sequence number telling producers and the consumer
+// whose turn it is, so producers only contend on the enqueue position and
+// the consumer never does an atomic read-modify-write.
+//
+// The consumer can block in waitForWork() once the ring stays empty; the
+// sleeping flag is checked by producers after every push, so an idle ring
+// costs a producer one relaxed load.
+template <typename T> struct MpscRing {
+  struct alignas(64) Cell {
+    std::atomic<uint64_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  uint64_t mask;
+
+  alignas(64) std::atomic<uint64_t> enqueue_pos{0};
+  alignas(64) uint64_t dequeue_pos = 0;
+  std::atomic<bool> sleeping{false};
+  std::atomic<uint32_t> wakeups{0};
+
+  explicit MpscRing(uint64_t capacity)
+      : cells{std::make_unique<Cell[]>(std::bit_ceil(capacity))},
+        mask{std::bit_ceil(capacity) - 1} {
+    for (uint64_t i = 0; i <= mask; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool tryPush(const T &value) {
+    auto pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+      auto &cell = cells[pos & mask];
+      auto sequence = cell.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<int64_t>(sequence - pos);
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // Full.
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Pushes value, yielding while the ring is full, and wakes the consumer if
+  // it is asleep.
+  void push(const T &value) {
+    while (!tryPush(value)) {
+      std::this_thread::yield();
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+      wakeups.fetch_add(1, std::memory_order_relaxed);
+      wakeups.notify_one();
+    }
+  }
+
+  // Consumer only.
+  bool tryPop(T &value) {
+    auto &cell = cells[dequeue_pos & mask];
+    if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos + 1) {
+      return false;
+    }
+    value = cell.value;
+    cell.sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+    ++dequeue_pos;
+    return true;
+  }
+
+  // Consumer only. Blocks until the ring is likely non-empty.
+  void waitForWork() {
+    auto seen = wakeups.load(std::memory_order_relaxed);
+    sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto &cell = cells[dequeue_pos & mask];
+    if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos + 1) {
+      wakeups.wait(seen);
+    }
+    sleeping.store(false, std::memory_order_relaxed);
+  }
+};
@@ -15,58 +15,181 @@
 #include <unordered_map>
 
 #include "instrument.hpp"
+#include "instrument_directory.hpp"
+
+// The instrument of the last buy or sell looked up through it, so that a run
+// of commands for one symbol in a batch looks the instrument up once.
+struct InstrumentCache {
+  uint64_t symbol = 0;
+  InstrumentNew *instrument = nullptr;
+};
 
 struct OrderBookNew {
-  // TODO: use a concurrent hash map
-  // Maps names to Instruments
-  std::unordered_map<std::string, std::unique_ptr<InstrumentNew>> instruments;
-  std::mutex instruments_mtx;
-
-  // Maps order ID to a pointer to the Instrument that it is in
-  std::unordered_map<uint32_t, InstrumentNew *> orders;
-  std::mutex orders_mtx;
-
-  std::atomic<intmax_t> timestamp;
-
-  OrderBookNew() : timestamp{0} {}
-
-  InstrumentNew &ensureInstrumentExists(std::string_view name) {
-    std::lock_guard lock{instruments_mtx};
-    // TODO: use an array of size 9 instead
-    std::string name_str{name};
-    auto &instrument = instruments[name_str];
-    if (!instrument) {
-      instrument = std::make_unique<InstrumentNew>(name_str, timestamp, orders,
-                                                   orders_mtx);
+  // Maps packed symbols to Instruments
+  InstrumentDirectory instruments;
+
+  // Maps order ID to where the order rests
+  OrderIndex orders;
+
+  // Clock for events outside any instrument, i.e. rejected cancels of
+  // orders the index doesn't know (any more).
+  EventClock timestamp;
+
+  // Where commands are journaled once they ran, if anywhere. Set before any
+  // command is handled.
+  Journal *journal = nullptr;
+
+  InstrumentNew &ensureInstrumentExists(const char *name) {
+    ProfileTimer timer{ProfileStage::Lookup};
+    return instruments.findOrCreate(packSymbol(name), [&] {
+      return std::make_unique<InstrumentNew>(
+          std::string(name, strnlen(name, 8)), orders);
+    });
+  }
+
+  InstrumentNew &ensureInstrumentExists(const char *name,
+                                        InstrumentCache &cache) {
+    auto symbol = packSymbol(name);
+    if (!cache.instrument || cache.symbol != symbol) {
+      cache.instrument = &ensureInstrumentExists(name);
+      cache.symbol = symbol;
     }
-    return *instrument;
+    return *cache.instrument;
   }
 
   void processBuyOrder(uint32_t order_id, uint32_t price, uint32_t count,
-                       std::string_view instrument_name) {
+                       const char *instrument_name,
+                       TimeInForce tif = TimeInForce::GoodTillCancel) {
     auto &instrument = ensureInstrumentExists(instrument_name);
-    instrument.handleBuyOrder(order_id, price, count);
+    instrument.handleBuyOrder(order_id, price, count, tif);
   }
 
   void processSellOrder(uint32_t order_id, uint32_t price, uint32_t count,
-                        std::string_view instrument_name) {
+                        const char *instrument_name,
+                        TimeInForce tif = TimeInForce::GoodTillCancel) {
     auto &instrument = ensureInstrumentExists(instrument_name);
-    instrument.handleSellOrder(order_id, price, count);
+    instrument.handleSellOrder(order_id, price, count, tif);
   }
 
   void processCancelOrder(uint32_t order_id) {
-    InstrumentNew *instrument;
-    {
-      auto it = orders.find(order_id);
-      if (it == orders.end()) {
-        Output::OrderDeleted(order_id, false,
-                             timestamp.fetch_add(1, std::memory_order_relaxed));
-        ++timestamp;
-        return;
+    auto location = [&] {
+      ProfileTimer timer{ProfileStage::Lookup};
+      return orders.find(order_id);
+    }();
+    if (!location) {
+      rejectCancel(order_id);
+      return;
+    }
+    auto &instrument = *location->instrument;
+    runJournaled(instrument, input_cancel, order_id, 0, 0, [&] {
+      instrument.handleCancelOrder(order_id, *location);
+    });
+  }
+
+  void processAmendOrder(uint32_t order_id, uint32_t price, uint32_t count) {
+    auto location = [&] {
+      ProfileTimer timer{ProfileStage::Lookup};
+      return orders.find(order_id);
+    }();
+    if (!location) {
+      rejectAmend(order_id, price, count);
+      return;
+    }
+    auto &instrument = *location->instrument;
+    runJournaled(instrument, input_amend, order_id, price, count, [&] {
+      instrument.handleAmendOrder(order_id, *location, price, count);
+    });
+  }
+
+  // Runs a command of EngineMode::THREADED on instrument through run(). While
+  // journaling, that is with the instrument's journal_lk held, and the
+  // command is journaled before the lock is released.
+  template <typename Run>
+  void runJournaled(InstrumentNew &instrument, CommandType type,
+                    uint32_t order_id, uint32_t price, uint32_t count,
+                    Run &&run) {
+    if (!journal) {
+      run();
+      return;
+    }
+    std::lock_guard lock{instrument.journal_lk};
+    run();
+    journal->append(type, order_id, price, count, instrument.name);
+  }
+
+  // Runs any buy, sell, cancel or amend; other command types are ignored.
+  void processCommand(const ClientCommand &input) {
+    switch (input.type) {
+    case input_cancel:
+      processCancelOrder(input.order_id);
+      break;
+    case input_buy:
+    case input_buy_ioc:
+    case input_buy_fok:
+      processBuyOrder(input.order_id, input.price, input.count,
+                      input.instrument, timeInForceOf(input.type));
+      break;
+    case input_sell:
+    case input_sell_ioc:
+    case input_sell_fok:
+      processSellOrder(input.order_id, input.price, input.count,
+                       input.instrument, timeInForceOf(input.type));
+      break;
+    case input_amend:
+      processAmendOrder(input.order_id, input.price, input.count);
+      break;
+    }
+  }
+
+  // Runs a command in EngineMode::COMBINING, through the flat combiner of its
+  // instrument. Other command types are ignored.
+  void combineCommand(const ClientCommand &input, InstrumentCache &cache) {
+    switch (input.type) {
+    case input_buy:
+    case input_buy_ioc:
+    case input_buy_fok:
+    case input_sell:
+    case input_sell_ioc:
+    case input_sell_fok:
+      ensureInstrumentExists(input.instrument, cache)
+          .combine({input.type, input.order_id, input.price, input.count, {}},
+                   journal);
+      break;
+    case input_cancel:
+    case input_amend: {
+      auto location = [&] {
+        ProfileTimer timer{ProfileStage::Lookup};
+        return orders.find(input.order_id);
+      }();
+      if (!location) {
+        if (input.type == input_cancel) {
+          rejectCancel(input.order_id);
+        } else {
+          rejectAmend(input.order_id, input.price, input.count);
+        }
+        break;
       }
-      instrument = it->second;
-      orders.erase(it);
+      location->instrument->combine(
+          {input.type, input.order_id, input.price, input.count, *location},
+          journal);
+      break;
+    }
+    }
+  }
+
+  // Rejects a cancel for an order that is not resting anywhere.
+  void rejectCancel(uint32_t order_id) {
+    Output::OrderDeleted(order_id, false, timestamp);
+    if (journal) {
+      journal->append(input_cancel, order_id, 0, 0, {});
+    }
+  }
+
+  // Rejects an amend of an order that is not resting anywhere.
+  void rejectAmend(uint32_t order_id, uint32_t price, uint32_t count) {
+    Output::OrderAmended(order_id, price, count, false, timestamp);
+    if (journal) {
+      journal->append(input_amend, order_id, price, count, {});
     }
-    instrument->handleCancelOrder(order_id);
   }
 };
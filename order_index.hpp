@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include "order_queue.hpp"
+
+struct InstrumentNew;
+
+// Where a resting order lives: its instrument, side and pool handle. The
+// handle is NULL_HANDLE while the order is still queued for a matching worker.
+struct OrderLocation {
+  InstrumentNew *instrument;
+  OrderHandle handle;
+  bool is_sell;
+};
+
+// Concurrent map of order_id to OrderLocation, shared by all instruments.
+//
+// Keys are spread over SHARD_COUNT independently locked shards, so threads
+// working on different orders rarely contend. Each shard is an open-addressing
+// table with linear probing and tombstones; slots are stored inline, so
+// inserts never allocate except when a shard grows.
+//
+// Growth is incremental: a shard that passes its load factor allocates a new
+// table and then moves MIGRATE_STEP slots of the old one over on every
+// subsequent operation, instead of rehashing everything at once. Lookups
+// check both tables while a migration is in progress.
+struct OrderIndex {
+  static constexpr uint32_t SHARD_BITS = 6;
+  static constexpr uint32_t SHARD_COUNT = 1u << SHARD_BITS;
+  static constexpr uint32_t INITIAL_CAPACITY = 64;
+  static constexpr uint32_t MIGRATE_STEP = 16;
+
+  enum class SlotState : uint8_t { EMPTY, FULL, TOMBSTONE };
+
+  struct Slot {
+    OrderLocation location;
+    uint32_t order_id;
+    SlotState state;
+  };
+
+  struct Table {
+    std::unique_ptr<Slot[]> slots;
+    uint32_t mask = 0;
+    // FULL plus TOMBSTONE slots, i.e. slots that lengthen probes.
+    uint32_t used = 0;
+    uint32_t live = 0;
+
+    Table() = default;
+    explicit Table(uint32_t capacity)
+        : slots{std::make_unique<Slot[]>(capacity)}, mask{capacity - 1} {}
+
+    uint32_t capacity() const { return slots ? mask + 1 : 0; }
+
+    Slot *find(uint32_t order_id, uint64_t hash) {
+      if (!slots) {
+        return nullptr;
+      }
+      for (auto i = static_cast<uint32_t>(hash) & mask;; i = (i + 1) & mask) {
+        auto &slot = slots[i];
+        if (slot.state == SlotState::EMPTY) {
+          return nullptr;
+        }
+        if (slot.state == SlotState::FULL && slot.order_id == order_id) {
+          return &slot;
+        }
+      }
+    }
+
+    // The caller guarantees that order_id is not in the table and that
+    // there is room for it.
+    void insert(uint32_t order_id, uint64_t hash,
+                const OrderLocation &location) {
+      auto i = static_cast<uint32_t>(hash) & mask;
+      while (slots[i].state == SlotState::FULL) {
+        i = (i + 1) & mask;
+      }
+      if (slots[i].state == SlotState::EMPTY) {
+        ++used;
+      }
+      slots[i] = {location, order_id, SlotState::FULL};
+      ++live;
+    }
+
+    void erase(Slot &slot) {
+      slot.state = SlotState::TOMBSTONE;
+      --live;
+    }
+  };
+
+  struct alignas(64) Shard {
+    std::mutex mtx;
+    Table table{INITIAL_CAPACITY};
+    // Table being drained into `table`, if a migration is in progress.
+    Table old;
+    uint32_t migrate_pos = 0;
+
+    void migrateStep(uint32_t steps) {
+      auto capacity = old.capacity();
+      for (; steps && migrate_pos < capacity; --steps, ++migrate_pos) {
+        auto &slot = old.slots[migrate_pos];
+        if (slot.state == SlotState::FULL) {
+          table.insert(slot.order_id, hashOf(slot.order_id), slot.location);
+        }
+      }
+      if (capacity && migrate_pos == capacity) {
+        old = Table{};
+      }
+    }
+
+    // Makes room for one more insert into `table`.
+    void reserveOne() {
+      if ((table.used + 1) * 2 <= table.capacity()) {
+        return;
+      }
+      // Only one migration at a time. This rarely has work left, since the
+      // new table was sized for at least as many inserts as it took over.
+      migrateStep(UINT32_MAX);
+
+      // Size for the live entries only, so tombstones are dropped. Leave
+      // room for at least as many inserts as there are live entries.
+      uint32_t capacity = INITIAL_CAPACITY;
+      while (capacity < table.live * 4) {
+        capacity *= 2;
+      }
+      old = std::move(table);
+      table = Table{capacity};
+      migrate_pos = 0;
+    }
+
+    Slot *find(uint32_t order_id, uint64_t hash) {
+      if (auto *slot = table.find(order_id, hash)) {
+        return slot;
+      }
+      return old.find(order_id, hash);
+    }
+  };
+
+  std::unique_ptr<Shard[]> shards = std::make_unique<Shard[]>(SHARD_COUNT);
+
+  static uint64_t hashOf(uint32_t order_id) {
+    return order_id * 0x9E3779B97F4A7C15ull;
+  }
+
+  Shard &shardOf(uint64_t hash) { return shards[hash >> (64 - SHARD_BITS)]; }
+
+  std::optional<OrderLocation> find(uint32_t order_id) {
+    auto hash = hashOf(order_id);
+    auto &shard = shardOf(hash);
+    std::lock_guard lock{shard.mtx};
+    shard.migrateStep(MIGRATE_STEP);
+    if (auto *slot = shard.find(order_id, hash)) {
+      return slot->location;
+    }
+    return std::nullopt;
+  }
+
+  // Inserts order_id, or updates its location if it is already present.
+  void assign(uint32_t order_id, const OrderLocation &location) {
+    auto hash = hashOf(order_id);
+    auto &shard = shardOf(hash);
+    std::lock_guard lock{shard.mtx};
+    shard.migrateStep(MIGRATE_STEP);
+    if (auto *slot = shard.table.find(order_id, hash)) {
+      slot->location = location;
+      return;
+    }
+    if (auto *slot = shard.old.find(order_id, hash)) {
+      shard.old.erase(*slot);
+    }
+    shard.reserveOne();
+    shard.table.insert(order_id, hash, location);
+  }
+
+  bool erase(uint32_t order_id) {
+    auto hash = hashOf(order_id);
+    auto &shard = shardOf(hash);
+    std::lock_guard lock{shard.mtx};
+    shard.migrateStep(MIGRATE_STEP);
+    if (auto *slot = shard.table.find(order_id, hash)) {
+      shard.table.erase(*slot);
+      return true;
+    }
+    if (auto *slot = shard.old.find(order_id, hash)) {
+      shard.old.erase(*slot);
+      return true;
+    }
+    return false;
+  }
+};
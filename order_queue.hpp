@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Index of an OrderNew inside an OrderPool. A handle stays valid (and keeps
+// pointing at the same record) until the order is released back to the pool,
+// so it can be stored in an index and used for O(1) cancels.
+using OrderHandle = uint32_t;
+constexpr OrderHandle NULL_HANDLE = UINT32_MAX;
+
+struct LimitNew;
+
+struct OrderNew {
+  uint32_t id;
+  uint32_t price;
+  uint32_t count;
+  uint32_t execution_id;
+
+  // Intrusive links of the FIFO at this price. While the record is free,
+  // count is 0 and next links the pool's free list instead.
+  OrderHandle prev;
+  OrderHandle next;
+
+  // Level the order rests at, so a cancel reaches it without a price
+  // lookup. Set by LimitNew::push().
+  LimitNew *limit;
+};
+
+// Slab allocator for OrderNew records. Records are carved out of fixed-size
+// slabs that are never moved or freed while the pool is alive, so references
+// obtained through a handle stay valid until that handle is released.
+//
+// Not thread-safe: each pool is owned by one side of one instrument and is
+// guarded by that side's lock.
+struct OrderPool {
+  static constexpr uint32_t SLAB_SHIFT = 12;
+  static constexpr uint32_t SLAB_SIZE = 1u << SLAB_SHIFT;
+  static constexpr uint32_t SLAB_MASK = SLAB_SIZE - 1;
+
+  std::vector<std::unique_ptr<OrderNew[]>> slabs;
+  // Records handed out from the last slab so far.
+  uint32_t slab_used = SLAB_SIZE;
+  OrderHandle free_head = NULL_HANDLE;
+
+  OrderNew &operator[](OrderHandle handle) {
+    return slabs[handle >> SLAB_SHIFT][handle & SLAB_MASK];
+  }
+
+  const OrderNew &operator[](OrderHandle handle) const {
+    return slabs[handle >> SLAB_SHIFT][handle & SLAB_MASK];
+  }
+
+  OrderHandle acquire() {
+    if (free_head != NULL_HANDLE) {
+      auto handle = free_head;
+      free_head = (*this)[handle].next;
+      return handle;
+    }
+    if (slab_used == SLAB_SIZE) {
+      slabs.push_back(std::make_unique_for_overwrite<OrderNew[]>(SLAB_SIZE));
+      slab_used = 0;
+    }
+    return static_cast<OrderHandle>(((slabs.size() - 1) << SLAB_SHIFT) |
+                                    slab_used++);
+  }
+
+  void release(OrderHandle handle) {
+    (*this)[handle].count = 0;
+    (*this)[handle].next = free_head;
+    free_head = handle;
+  }
+
+  // Whether handle still refers to the resting order order_id. Handles read
+  // from an index may be stale, since records are reused once released.
+  bool holds(OrderHandle handle, uint32_t order_id) const {
+    if (handle == NULL_HANDLE) {
+      return false;
+    }
+    auto &record = (*this)[handle];
+    return record.count && record.id == order_id;
+  }
+
+  size_t capacity() const { return slabs.size() * SLAB_SIZE; }
+};
+
+// Intrusive FIFO of orders resting at one price. The queue only stores the
+// two end handles; the records themselves live in the side's OrderPool.
+struct OrderQueue {
+  OrderHandle head = NULL_HANDLE;
+  OrderHandle tail = NULL_HANDLE;
+
+  bool empty() const { return head == NULL_HANDLE; }
+
+  OrderHandle front() const { return head; }
+
+  OrderHandle pushBack(OrderPool &pool, const OrderNew &order) {
+    auto handle = pool.acquire();
+    auto &record = pool[handle];
+    record = order;
+    record.prev = tail;
+    record.next = NULL_HANDLE;
+    if (tail == NULL_HANDLE) {
+      head = handle;
+    } else {
+      pool[tail].next = handle;
+    }
+    tail = handle;
+    return handle;
+  }
+
+  void popFront(OrderPool &pool) {
+    assert(!empty());
+    erase(pool, head);
+  }
+
+  // Unlinks the order from the queue and releases it back to the pool.
+  void erase(OrderPool &pool, OrderHandle handle) {
+    auto &record = pool[handle];
+    if (record.prev == NULL_HANDLE) {
+      head = record.next;
+    } else {
+      pool[record.prev].next = record.next;
+    }
+    if (record.next == NULL_HANDLE) {
+      tail = record.prev;
+    } else {
+      pool[record.next].prev = record.prev;
+    }
+    pool.release(handle);
+  }
+};
@@ -0,0 +1,564 @@
+// Output backends.
+//
+// In OutputMode::Async every producing thread owns a ProducerBuffer, a ring
+// of fixed-size events. Producers never take a lock: they claim their next
+// slot, take the timestamp, fill the event in and mark it ready. A single
+// writer thread merges the buffers by timestamp, formats the events and
+// writes them out in large batches. OutputMode::Binary is the same, except
+// that the writer encodes compact records (see binary_output.hpp) instead of
+// formatting text.
+//
+// Merging is what keeps the output causally ordered across threads (an order
+// must be added before another thread's execution against it is printed):
+//
+// - A slot is marked CLAIMED before its timestamp is taken, and timestamps
+//   follow real time (see EventClock). So once the writer has seen an event
+//   with timestamp M as ready, a buffer whose head it later sees FREE can only
+//   produce timestamps above M.
+// - The writer therefore takes M, the largest ready head, and then repeatedly
+//   emits the smallest head until none at or below M is left, waiting out any
+//   head that is CLAIMED.
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "binary_output.hpp"
+#include "io.hpp"
+#include "profile.hpp"
+
+namespace {
+
+enum SlotState : uint8_t { SLOT_FREE, SLOT_CLAIMED, SLOT_READY };
+
+struct Event {
+  std::atomic<uint8_t> state{SLOT_FREE};
+  char kind; // 'B', 'S', 'E', 'X', 'M' or 'K'
+  // Whether an 'X' cancel or an 'M' amend was accepted.
+  bool accepted;
+  uint32_t id;
+  uint32_t new_id;
+  uint32_t execution_id;
+  uint32_t price;
+  uint32_t count;
+  char symbol[8];
+  intmax_t timestamp;
+};
+
+struct ProducerBuffer {
+  static constexpr uint32_t CAPACITY = 1024;
+
+  Event events[CAPACITY];
+  // Producer side.
+  alignas(64) uint32_t tail = 0;
+  // Writer side.
+  alignas(64) uint32_t head = 0;
+  // Whether a live thread produces into this buffer. Buffers of exited
+  // threads are handed to new threads instead of being freed, since the
+  // writer may still be draining them.
+  std::atomic<bool> owned{true};
+  ProducerBuffer *next = nullptr;
+};
+
+OutputMode output_mode = OutputMode::Async;
+int output_fd = 1;
+
+void writeAll(const char *data, size_t size) {
+  while (size) {
+    auto written = write(output_fd, data, size);
+    if (written <= 0) {
+      return;
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+struct Writer {
+  static constexpr size_t BATCH_BYTES = 1 << 16;
+
+  // Prepend-only list of every buffer ever created.
+  std::atomic<ProducerBuffer *> producers{nullptr};
+
+  std::atomic<bool> sleeping{false};
+  std::atomic<bool> stopping{false};
+  std::atomic<uint32_t> wakeups{0};
+  std::thread thread;
+  // Serialises drain() between the writer thread and flush().
+  std::mutex drain_mtx;
+  std::vector<char> batch;
+
+  ProducerBuffer &acquireBuffer() {
+    auto *head = producers.load(std::memory_order_acquire);
+    for (auto *buffer = head; buffer; buffer = buffer->next) {
+      bool expected = false;
+      if (!buffer->owned.load(std::memory_order_relaxed) &&
+          buffer->owned.compare_exchange_strong(expected, true)) {
+        return *buffer;
+      }
+    }
+    auto *buffer = new ProducerBuffer;
+    buffer->next = head;
+    while (!producers.compare_exchange_weak(buffer->next, buffer,
+                                            std::memory_order_release)) {
+    }
+    return *buffer;
+  }
+
+  void wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+      wakeups.fetch_add(1, std::memory_order_relaxed);
+      wakeups.notify_one();
+    }
+  }
+
+  void format(const Event &event) {
+    ProfileTimer timer{ProfileStage::Format};
+    // Room for the longest line: five numbers and a timestamp of at most 20
+    // digits each, the symbol and the separators.
+    constexpr size_t MAX_DIGITS = 20;
+    char line[160];
+    char *out = line;
+    auto number = [&](auto value) {
+      out = std::to_chars(out, out + MAX_DIGITS, value).ptr;
+      *out++ = ' ';
+    };
+    *out++ = event.kind;
+    *out++ = ' ';
+    switch (event.kind) {
+    case 'B':
+    case 'S':
+      number(event.id);
+      for (size_t i = 0; i < sizeof(event.symbol) && event.symbol[i]; ++i) {
+        *out++ = event.symbol[i];
+      }
+      *out++ = ' ';
+      number(event.price);
+      number(event.count);
+      break;
+    case 'E':
+      number(event.id);
+      number(event.new_id);
+      number(event.execution_id);
+      number(event.price);
+      number(event.count);
+      break;
+    case 'X':
+      number(event.id);
+      *out++ = event.accepted ? 'A' : 'R';
+      *out++ = ' ';
+      break;
+    case 'M':
+      number(event.id);
+      number(event.price);
+      number(event.count);
+      *out++ = event.accepted ? 'A' : 'R';
+      *out++ = ' ';
+      break;
+    case 'K':
+      number(event.id);
+      number(event.count);
+      break;
+    }
+    out = std::to_chars(out, out + MAX_DIGITS, event.timestamp).ptr;
+    *out++ = '\n';
+    batch.insert(batch.end(), line, out);
+    if (batch.size() >= BATCH_BYTES) {
+      writeAll(batch.data(), batch.size());
+      batch.clear();
+    }
+  }
+
+  // OutputMode::Binary stream state: the last timestamp encoded, and the
+  // index of every symbol named so far by its packed characters.
+  int64_t last_timestamp = 0;
+  std::unordered_map<uint64_t, uint32_t> symbols;
+
+  void encode(const Event &event) {
+    ProfileTimer timer{ProfileStage::Format};
+    char record[MAX_BINARY_RECORD];
+    char *out = record;
+    auto put = [&](uint64_t value) { out = putVarint(out, value); };
+    bool rejected = (event.kind == 'X' || event.kind == 'M') && !event.accepted;
+    *out++ = rejected ? static_cast<char>(event.kind | 0x20) : event.kind;
+    put(event.id);
+    switch (event.kind) {
+    case 'B':
+    case 'S': {
+      // Padded with NULs by strncpy() in OrderAdded().
+      uint64_t packed;
+      memcpy(&packed, event.symbol, sizeof(packed));
+      auto [symbol, added] = symbols.try_emplace(
+          packed, static_cast<uint32_t>(symbols.size()));
+      put(symbol->second);
+      if (added) {
+        auto length = strnlen(event.symbol, sizeof(event.symbol));
+        *out++ = static_cast<char>(length);
+        memcpy(out, event.symbol, length);
+        out += length;
+      }
+      put(event.price);
+      put(event.count);
+      break;
+    }
+    case 'E':
+      put(event.new_id);
+      put(event.execution_id);
+      put(event.price);
+      put(event.count);
+      break;
+    case 'M':
+      put(event.price);
+      put(event.count);
+      break;
+    case 'K':
+      put(event.count);
+      break;
+    }
+    auto timestamp = static_cast<int64_t>(event.timestamp);
+    put(zigzag(timestamp - last_timestamp));
+    last_timestamp = timestamp;
+    batch.insert(batch.end(), record, out);
+    if (batch.size() >= BATCH_BYTES) {
+      writeAll(batch.data(), batch.size());
+      batch.clear();
+    }
+  }
+
+  static Event &headOf(ProducerBuffer &buffer) {
+    return buffer.events[buffer.head % ProducerBuffer::CAPACITY];
+  }
+
+  // Emits every event that is known to be next in timestamp order. Returns
+  // whether anything was emitted.
+  bool drain() {
+    std::lock_guard lock{drain_mtx};
+    bool emitted = false;
+    auto *list = producers.load(std::memory_order_acquire);
+    while (true) {
+      bool any_ready = false;
+      intmax_t bound = 0;
+      for (auto *buffer = list; buffer; buffer = buffer->next) {
+        auto &event = headOf(*buffer);
+        if (event.state.load(std::memory_order_acquire) == SLOT_READY) {
+          bound = any_ready ? std::max(bound, event.timestamp)
+                            : event.timestamp;
+          any_ready = true;
+        }
+      }
+      if (!any_ready) {
+        break;
+      }
+
+      while (true) {
+        ProducerBuffer *next = nullptr;
+        for (auto *buffer = list; buffer; buffer = buffer->next) {
+          auto &event = headOf(*buffer);
+          auto state = event.state.load();
+          while (state == SLOT_CLAIMED) {
+            // The producer is between claiming and publishing; its
+            // timestamp is unknown but may be the smallest one.
+            std::this_thread::yield();
+            state = event.state.load();
+          }
+          if (state == SLOT_READY && event.timestamp <= bound &&
+              (!next || event.timestamp < headOf(*next).timestamp)) {
+            next = buffer;
+          }
+        }
+        if (!next) {
+          break;
+        }
+        auto &event = headOf(*next);
+        if (output_mode == OutputMode::Binary) {
+          encode(event);
+        } else {
+          format(event);
+        }
+        event.state.store(SLOT_FREE, std::memory_order_release);
+        ++next->head;
+        emitted = true;
+      }
+    }
+    if (!batch.empty()) {
+      writeAll(batch.data(), batch.size());
+      batch.clear();
+    }
+    return emitted;
+  }
+
+  void run() {
+    // An exit signal handled here would run flush(), and so stop(), on this
+    // thread, which can't join itself; leave those to the other threads.
+    sigset_t exit_signals;
+    sigemptyset(&exit_signals);
+    sigaddset(&exit_signals, SIGINT);
+    sigaddset(&exit_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &exit_signals, nullptr);
+
+    constexpr int SPINS_BEFORE_SLEEP = 256;
+    int idle = 0;
+    while (!stopping.load(std::memory_order_relaxed)) {
+      if (drain()) {
+        idle = 0;
+        continue;
+      }
+      if (++idle < SPINS_BEFORE_SLEEP) {
+        std::this_thread::yield();
+        continue;
+      }
+      auto seen = wakeups.load(std::memory_order_relaxed);
+      sleeping.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!drain()) {
+        wakeups.wait(seen);
+      }
+      sleeping.store(false, std::memory_order_relaxed);
+      idle = 0;
+    }
+  }
+
+  void start() {
+    batch.reserve(BATCH_BYTES + 128);
+    thread = std::thread(&Writer::run, this);
+    atexit(Output::flush);
+  }
+
+  void stop() {
+    if (!thread.joinable()) {
+      return;
+    }
+    stopping.store(true);
+    wakeups.fetch_add(1);
+    wakeups.notify_one();
+    thread.join();
+  }
+};
+
+std::atomic<bool> writer_started{false};
+
+Writer &writer() {
+  static Writer instance;
+  static std::once_flag started;
+  std::call_once(started, [] {
+    instance.start();
+    writer_started.store(true);
+  });
+  return instance;
+}
+
+struct LocalBuffer {
+  ProducerBuffer *buffer = nullptr;
+
+  ~LocalBuffer() {
+    if (buffer) {
+      buffer->owned.store(false, std::memory_order_release);
+    }
+  }
+};
+
+thread_local LocalBuffer local_buffer;
+
+// How many Output::Batch are alive on this thread, and whether events were
+// produced under them that still need the writer woken or stdout flushed.
+thread_local unsigned batch_depth = 0;
+thread_local bool batch_pending = false;
+
+// Ends a line in OutputMode::Sync; the flush waits for the end of a batch.
+std::ostream &endLine(std::ostream &os) {
+  os << '\n';
+  if (batch_depth) {
+    batch_pending = true;
+  } else {
+    os.flush();
+  }
+  return os;
+}
+
+// Claims the calling thread's next slot, stamps it from clock and lets fill
+// complete it before publishing it to the writer.
+template <typename Fill> void produce(EventClock &clock, Fill &&fill) {
+  auto &out = writer();
+  if (!local_buffer.buffer) {
+    local_buffer.buffer = &out.acquireBuffer();
+  }
+  auto &buffer = *local_buffer.buffer;
+  auto &event = buffer.events[buffer.tail % ProducerBuffer::CAPACITY];
+  while (event.state.load(std::memory_order_acquire) != SLOT_FREE) {
+    // Our buffer is full; make sure the writer is awake to drain it.
+    out.wake();
+    std::this_thread::yield();
+  }
+  event.state.store(SLOT_CLAIMED);
+  event.timestamp = clock.next();
+  fill(event);
+  event.state.store(SLOT_READY, std::memory_order_release);
+  ++buffer.tail;
+  if (batch_depth) {
+    batch_pending = true;
+  } else {
+    out.wake();
+  }
+}
+
+} // namespace
+
+void Output::configure(OutputMode mode, int fd) {
+  output_mode = mode;
+  output_fd = fd;
+}
+
+void Output::flush() {
+  if (output_mode == OutputMode::Async || output_mode == OutputMode::Binary) {
+    if (!writer_started.load()) {
+      return;
+    }
+    auto &out = writer();
+    out.stop();
+    out.drain();
+  } else if (output_mode == OutputMode::Sync) {
+    SyncCout() << std::flush;
+  }
+}
+
+Output::Batch::Batch() { ++batch_depth; }
+
+Output::Batch::~Batch() {
+  if (--batch_depth || !batch_pending) {
+    return;
+  }
+  batch_pending = false;
+  if (output_mode == OutputMode::Async || output_mode == OutputMode::Binary) {
+    writer().wake();
+  } else if (output_mode == OutputMode::Sync) {
+    SyncCout() << std::flush;
+  }
+}
+
+void Output::OrderAdded(uint32_t id, const char *symbol, uint32_t price,
+                        uint32_t count, bool is_sell_side, EventClock &clock) {
+  ProfileTimer timer{ProfileStage::Output};
+  switch (output_mode) {
+  case OutputMode::Sync:
+    SyncCout() << (is_sell_side ? "S " : "B ") << id << " " << symbol << " "
+               << price << " " << count << " " << clock.next() << endLine;
+    break;
+  case OutputMode::Async:
+  case OutputMode::Binary:
+    produce(clock, [&](Event &event) {
+      event.kind = is_sell_side ? 'S' : 'B';
+      event.id = id;
+      strncpy(event.symbol, symbol, sizeof(event.symbol));
+      event.price = price;
+      event.count = count;
+    });
+    break;
+  case OutputMode::Discard:
+    clock.next();
+    break;
+  }
+}
+
+void Output::OrderExecuted(uint32_t resting_id, uint32_t new_id,
+                           uint32_t execution_id, uint32_t price,
+                           uint32_t count, EventClock &clock) {
+  ProfileTimer timer{ProfileStage::Output};
+  switch (output_mode) {
+  case OutputMode::Sync:
+    SyncCout() << "E " << resting_id << " " << new_id << " " << execution_id
+               << " " << price << " " << count << " " << clock.next()
+               << endLine;
+    break;
+  case OutputMode::Async:
+  case OutputMode::Binary:
+    produce(clock, [&](Event &event) {
+      event.kind = 'E';
+      event.id = resting_id;
+      event.new_id = new_id;
+      event.execution_id = execution_id;
+      event.price = price;
+      event.count = count;
+    });
+    break;
+  case OutputMode::Discard:
+    clock.next();
+    break;
+  }
+}
+
+void Output::OrderDeleted(uint32_t id, bool cancel_accepted,
+                          EventClock &clock) {
+  ProfileTimer timer{ProfileStage::Output};
+  switch (output_mode) {
+  case OutputMode::Sync:
+    SyncCout() << "X " << id << " " << (cancel_accepted ? "A " : "R ")
+               << clock.next() << endLine;
+    break;
+  case OutputMode::Async:
+  case OutputMode::Binary:
+    produce(clock, [&](Event &event) {
+      event.kind = 'X';
+      event.id = id;
+      event.accepted = cancel_accepted;
+    });
+    break;
+  case OutputMode::Discard:
+    clock.next();
+    break;
+  }
+}
+
+void Output::OrderAmended(uint32_t id, uint32_t price, uint32_t count,
+                          bool amend_accepted, EventClock &clock) {
+  ProfileTimer timer{ProfileStage::Output};
+  switch (output_mode) {
+  case OutputMode::Sync:
+    SyncCout() << "M " << id << " " << price << " " << count << " "
+               << (amend_accepted ? "A " : "R ") << clock.next() << endLine;
+    break;
+  case OutputMode::Async:
+  case OutputMode::Binary:
+    produce(clock, [&](Event &event) {
+      event.kind = 'M';
+      event.id = id;
+      event.price = price;
+      event.count = count;
+      event.accepted = amend_accepted;
+    });
+    break;
+  case OutputMode::Discard:
+    clock.next();
+    break;
+  }
+}
+
+void Output::OrderKilled(uint32_t id, uint32_t count, EventClock &clock) {
+  ProfileTimer timer{ProfileStage::Output};
+  switch (output_mode) {
+  case OutputMode::Sync:
+    SyncCout() << "K " << id << " " << count << " " << clock.next() << endLine;
+    break;
+  case OutputMode::Async:
+  case OutputMode::Binary:
+    produce(clock, [&](Event &event) {
+      event.kind = 'K';
+      event.id = id;
+      event.count = count;
+    });
+    break;
+  case OutputMode::Discard:
+    clock.next();
+    break;
+  }
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+
+#include "order_queue.hpp"
+
+struct LimitNew;
+
+// Tree of price levels used by MapLevels. Keys are ordered best first for
+// both sides, so that the iterator type is the same for bids and asks.
+using LevelMap = std::map<uint32_t, std::unique_ptr<LimitNew>>;
+
+struct LimitNew {
+  // FIFO of orders at this price, stored in the side's OrderPool
+  OrderQueue orders;
+  // Remaining count of all orders in the queue, and how many there are.
+  // Kept up to date by InstrumentNew as orders rest, fill and cancel.
+  uint64_t quantity = 0;
+  uint32_t order_count = 0;
+  // This level's node in MapLevels, so it is erased without a search.
+  // Unused by the dense levels of a LadderLevels.
+  LevelMap::iterator node;
+
+  // Rests order at the back of the queue and points it at this level.
+  OrderHandle push(OrderPool &pool, const OrderNew &order) {
+    auto handle = orders.pushBack(pool, order);
+    pool[handle].limit = this;
+    quantity += order.count;
+    ++order_count;
+    return handle;
+  }
+
+  // Unlinks a resting order with whatever count it has left, and releases
+  // it back to the pool.
+  void remove(OrderPool &pool, OrderHandle handle) {
+    quantity -= pool[handle].count;
+    --order_count;
+    orders.erase(pool, handle);
+  }
+};
+
+// Aggregates of one price level, as reported by InstrumentNew::depth().
+struct DepthLevel {
+  uint32_t price;
+  uint32_t orders;
+  uint64_t quantity;
+
+  bool operator==(const DepthLevel &) const = default;
+};
+
+// A price level as returned by the level containers. limit is null when
+// there is no such level.
+struct LevelRef {
+  uint32_t price;
+  LimitNew *limit;
+};
+
+// Price levels of one side, kept in a red-black tree. Compare orders prices
+// from best to worst, i.e. std::greater for bids and std::less for asks.
+template <typename Compare> struct MapLevels {
+  static constexpr bool HIGHEST_FIRST = Compare{}(1u, 0u);
+
+  // Bid prices are stored complemented, so that the best level comes first
+  // in ascending key order on both sides. The mapping is its own inverse.
+  static uint32_t keyOf(uint32_t price) {
+    return HIGHEST_FIRST ? ~price : price;
+  }
+
+  LevelMap levels;
+
+  bool empty() const { return levels.empty(); }
+
+  LevelRef best() {
+    if (levels.empty()) {
+      return {0, nullptr};
+    }
+    auto &[key, limit] = *levels.begin();
+    return {keyOf(key), limit.get()};
+  }
+
+  LimitNew *find(uint32_t price) {
+    auto it = levels.find(keyOf(price));
+    return it == levels.end() ? nullptr : it->second.get();
+  }
+
+  LimitNew &ensure(uint32_t price) {
+    auto [it, inserted] = levels.try_emplace(keyOf(price));
+    if (inserted) {
+      it->second = std::make_unique<LimitNew>();
+      it->second->node = it;
+    }
+    return *it->second;
+  }
+
+  // Erases the level at price, which must be limit. Goes straight to the
+  // level's node rather than searching the tree.
+  void erase(uint32_t, LimitNew &limit) { levels.erase(limit.node); }
+
+  // Calls fn(price, limit) for every level, best first.
+  template <typename Fn> void forEach(Fn &&fn) {
+    for (auto &[key, limit] : levels) {
+      fn(keyOf(key), *limit);
+    }
+  }
+
+  // Calls fn(price, limit) for levels best first, until it returns false.
+  // Returns false if fn did.
+  template <typename Fn> bool forEachBest(Fn &&fn) {
+    for (auto &[key, limit] : levels) {
+      if (!fn(keyOf(key), *limit)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Price levels of one side, kept in a dense array covering a window of
+// LADDER_LEVELS prices. A two-level occupancy bitmap (one summary word over
+// 64 words of 64 levels each) finds the best level with two bit scans.
+//
+// The window is anchored around the first price seen while the ladder is
+// empty. Prices outside of it fall back to a MapLevels, so correctness never
+// depends on prices staying in the band, only the speed does.
+template <typename Compare> struct LadderLevels {
+  static constexpr uint32_t WORD_BITS = 64;
+  static constexpr uint32_t LADDER_WORDS = 64;
+  static constexpr uint32_t LADDER_LEVELS = WORD_BITS * LADDER_WORDS;
+
+  // Whether the best price is the highest one (bids) or the lowest (asks).
+  static constexpr bool HIGHEST_FIRST = Compare{}(1u, 0u);
+
+  uint32_t base = 0;
+  uint32_t dense_count = 0;
+  uint64_t summary = 0;
+  uint64_t occupied[LADDER_WORDS] = {};
+  std::unique_ptr<LimitNew[]> dense = std::make_unique<LimitNew[]>(LADDER_LEVELS);
+  MapLevels<Compare> sparse;
+
+  bool empty() const { return dense_count == 0 && sparse.empty(); }
+
+  bool inWindow(uint32_t price) const {
+    return price >= base && price - base < LADDER_LEVELS;
+  }
+
+  bool isSet(uint32_t offset) const {
+    return occupied[offset / WORD_BITS] >> (offset % WORD_BITS) & 1;
+  }
+
+  LevelRef best() {
+    auto sparse_best = sparse.best();
+    if (!summary) {
+      return sparse_best;
+    }
+    uint32_t word, bit;
+    if constexpr (HIGHEST_FIRST) {
+      word = WORD_BITS - 1 - static_cast<uint32_t>(std::countl_zero(summary));
+      bit = WORD_BITS - 1 -
+            static_cast<uint32_t>(std::countl_zero(occupied[word]));
+    } else {
+      word = static_cast<uint32_t>(std::countr_zero(summary));
+      bit = static_cast<uint32_t>(std::countr_zero(occupied[word]));
+    }
+    auto offset = word * WORD_BITS + bit;
+    auto price = base + offset;
+    if (sparse_best.limit && Compare{}(sparse_best.price, price)) {
+      return sparse_best;
+    }
+    return {price, &dense[offset]};
+  }
+
+  LimitNew *find(uint32_t price) {
+    if (!inWindow(price)) {
+      return sparse.find(price);
+    }
+    auto offset = price - base;
+    return isSet(offset) ? &dense[offset] : nullptr;
+  }
+
+  LimitNew &ensure(uint32_t price) {
+    if (empty()) {
+      base = price > LADDER_LEVELS / 2 ? price - LADDER_LEVELS / 2 : 0;
+    }
+    if (!inWindow(price)) {
+      return sparse.ensure(price);
+    }
+    auto offset = price - base;
+    if (!isSet(offset)) {
+      dense[offset] = LimitNew{};
+      occupied[offset / WORD_BITS] |= uint64_t{1} << (offset % WORD_BITS);
+      summary |= uint64_t{1} << (offset / WORD_BITS);
+      ++dense_count;
+    }
+    return dense[offset];
+  }
+
+  // Erases the level at price, which must be limit.
+  void erase(uint32_t price, LimitNew &limit) {
+    if (!inWindow(price)) {
+      sparse.erase(price, limit);
+      return;
+    }
+    auto offset = price - base;
+    auto &word = occupied[offset / WORD_BITS];
+    word &= ~(uint64_t{1} << (offset % WORD_BITS));
+    if (!word) {
+      summary &= ~(uint64_t{1} << (offset / WORD_BITS));
+    }
+    --dense_count;
+  }
+
+  // Calls fn(price, limit) for every level: the window in ascending price
+  // order, then the levels outside it.
+  template <typename Fn> void forEach(Fn &&fn) {
+    for (uint32_t word = 0; word < LADDER_WORDS; ++word) {
+      for (auto bits = occupied[word]; bits; bits &= bits - 1) {
+        auto offset =
+            word * WORD_BITS + static_cast<uint32_t>(std::countr_zero(bits));
+        fn(base + offset, dense[offset]);
+      }
+    }
+    sparse.forEach(fn);
+  }
+
+  // Calls fn(price, limit) for levels best first, until it returns false:
+  // the sparse levels beyond the window's best end, the window, then the
+  // sparse levels beyond its worst end. Returns false if fn did.
+  template <typename Fn> bool forEachBest(Fn &&fn) {
+    // Not base + LADDER_LEVELS, which wraps for windows near 2^32.
+    auto beyond_best = [this](uint32_t price) {
+      return HIGHEST_FIRST ? price >= base && price - base >= LADDER_LEVELS
+                           : price < base;
+    };
+    bool in_window = false;
+    return sparse.forEachBest([&](uint32_t price, LimitNew &limit) {
+      if (!in_window && !beyond_best(price)) {
+        in_window = true;
+        if (!forEachBestInWindow(fn)) {
+          return false;
+        }
+      }
+      return fn(price, limit);
+    }) && (in_window || forEachBestInWindow(fn));
+  }
+
+  template <typename Fn> bool forEachBestInWindow(Fn &&fn) {
+    for (auto words = summary; words;) {
+      uint32_t word = HIGHEST_FIRST
+                          ? WORD_BITS - 1 - static_cast<uint32_t>(
+                                                std::countl_zero(words))
+                          : static_cast<uint32_t>(std::countr_zero(words));
+      words &= ~(uint64_t{1} << word);
+      for (auto bits = occupied[word]; bits;) {
+        uint32_t bit = HIGHEST_FIRST
+                           ? WORD_BITS - 1 - static_cast<uint32_t>(
+                                                 std::countl_zero(bits))
+                           : static_cast<uint32_t>(std::countr_zero(bits));
+        bits &= ~(uint64_t{1} << bit);
+        auto offset = word * WORD_BITS + bit;
+        if (!fn(base + offset, dense[offset])) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+};
+
+// The level container used by InstrumentNew. Build with PRICE_LADDER=1 to use
+// the dense ladder instead of the tree.
+#ifdef PRICE_LADDER
+using BuyLevels = LadderLevels<std::greater<uint32_t>>;
+using SellLevels = LadderLevels<std::less<uint32_t>>;
+#else
+using BuyLevels = MapLevels<std::greater<uint32_t>>;
+using SellLevels = MapLevels<std::less<uint32_t>>;
+#endif
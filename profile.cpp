@@ -0,0 +1,283 @@
+#include "profile.hpp"
+
+#ifdef ENGINE_PROFILE
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Log-linear buckets in the style of HdrHistogram: values below SUB_COUNT
+// have a bucket each, and every power of two above that is split into
+// SUB_COUNT buckets, so bucket bounds are within 12.5% of each other.
+// Values are capped at 2^MAX_BITS - 1 ns, about 18 minutes.
+constexpr int SUB_BITS = 3;
+constexpr uint64_t SUB_COUNT = 1u << SUB_BITS;
+constexpr int MAX_BITS = 40;
+constexpr uint64_t MAX_VALUE = (uint64_t{1} << MAX_BITS) - 1;
+constexpr size_t BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+size_t bucketOf(uint64_t value) {
+  if (value < SUB_COUNT) {
+    return value;
+  }
+  auto msb = 63 - __builtin_clzll(value);
+  auto sub = (value >> (msb - SUB_BITS)) & (SUB_COUNT - 1);
+  return static_cast<size_t>(msb - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+// The largest value that lands in bucket.
+uint64_t bucketLimit(size_t bucket) {
+  if (bucket + 1 >= BUCKETS) {
+    return MAX_VALUE;
+  }
+  auto next = bucket + 1;
+  if (next < SUB_COUNT) {
+    return bucket;
+  }
+  auto msb = static_cast<int>(next / SUB_COUNT) + SUB_BITS - 1;
+  return ((SUB_COUNT + next % SUB_COUNT) << (msb - SUB_BITS)) - 1;
+}
+
+// Only the owning thread writes, so counters are bumped with a plain load
+// and store; the atomics just let dumps read them at any time.
+void bump(std::atomic<uint64_t> &counter, uint64_t by = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + by,
+                std::memory_order_relaxed);
+}
+
+struct Histogram {
+  std::atomic<uint64_t> buckets[BUCKETS] = {};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> max{0};
+
+  void record(intmax_t ns) {
+    auto value = std::min(static_cast<uint64_t>(std::max<intmax_t>(ns, 0)),
+                          MAX_VALUE);
+    bump(buckets[bucketOf(value)]);
+    bump(count);
+    bump(sum, value);
+    if (value > max.load(std::memory_order_relaxed)) {
+      max.store(value, std::memory_order_relaxed);
+    }
+  }
+};
+
+// Totals of several histograms, taken for a dump.
+struct Summary {
+  uint64_t buckets[BUCKETS] = {};
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+
+  void add(const Histogram &histogram) {
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+    }
+    count += histogram.count.load(std::memory_order_relaxed);
+    sum += histogram.sum.load(std::memory_order_relaxed);
+    max = std::max(max, histogram.max.load(std::memory_order_relaxed));
+  }
+
+  uint64_t percentile(double fraction) const {
+    auto rank = static_cast<uint64_t>(fraction * static_cast<double>(count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      seen += buckets[i];
+      if (seen > rank) {
+        return std::min(bucketLimit(i), max);
+      }
+    }
+    return max;
+  }
+};
+
+struct ThreadProfile {
+  Histogram stages[static_cast<size_t>(ProfileStage::COUNT)];
+
+  // Lock waits by instrument name. The owner looks entries up without a
+  // lock; inserts and dumps take mtx.
+  std::unordered_map<const std::string *, Histogram> lock_waits;
+  std::mutex mtx;
+  // The owner's current instrument, see Profile::setInstrument().
+  Histogram *current = nullptr;
+
+  // Whether a live thread records into this profile. Profiles of exited
+  // threads are handed to new threads instead of being freed, so their
+  // counts stay in the totals.
+  std::atomic<bool> owned{true};
+  ThreadProfile *next = nullptr;
+};
+
+// Prepend-only list of every profile ever created.
+std::atomic<ThreadProfile *> profiles{nullptr};
+
+ThreadProfile &acquireProfile() {
+  auto *head = profiles.load(std::memory_order_acquire);
+  for (auto *profile = head; profile; profile = profile->next) {
+    bool expected = false;
+    if (!profile->owned.load(std::memory_order_relaxed) &&
+        profile->owned.compare_exchange_strong(expected, true)) {
+      profile->current = nullptr;
+      return *profile;
+    }
+  }
+  auto *profile = new ThreadProfile;
+  profile->next = head;
+  while (!profiles.compare_exchange_weak(profile->next, profile,
+                                         std::memory_order_release)) {
+  }
+  return *profile;
+}
+
+struct LocalProfile {
+  ThreadProfile *profile = nullptr;
+
+  ~LocalProfile() {
+    if (profile) {
+      profile->owned.store(false, std::memory_order_release);
+    }
+  }
+
+  ThreadProfile &get() {
+    if (!profile) {
+      profile = &acquireProfile();
+    }
+    return *profile;
+  }
+};
+
+thread_local LocalProfile local_profile;
+
+const char *const STAGE_NAMES[] = {"read",  "lookup", "match", "cancel",
+                                   "amend", "output", "format"};
+static_assert(std::size(STAGE_NAMES) ==
+              static_cast<size_t>(ProfileStage::COUNT));
+
+void appendRow(std::string &out, const char *name, const Summary &summary,
+               uint64_t second) {
+  char row[160];
+  snprintf(row, sizeof(row),
+           "%-10s %12llu %12llu %10llu %10llu %10llu %12llu\n", name,
+           static_cast<unsigned long long>(summary.count),
+           static_cast<unsigned long long>(second),
+           static_cast<unsigned long long>(summary.percentile(0.5)),
+           static_cast<unsigned long long>(summary.percentile(0.99)),
+           static_cast<unsigned long long>(summary.percentile(0.999)),
+           static_cast<unsigned long long>(summary.max));
+  out += row;
+}
+
+} // namespace
+
+void Profile::start() {
+  static std::once_flag started;
+  std::call_once(started, [] {
+    sigset_t set, all, old;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    // The dump thread blocks every signal, so that signals the engine sets
+    // up later (e.g. SIGUSR2) never land on it.
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    std::thread([set] {
+      while (true) {
+        int signum;
+        if (sigwait(&set, &signum) == 0) {
+          dump();
+        }
+      }
+    }).detach();
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    atexit(dump);
+  });
+}
+
+void Profile::dump() {
+  Summary stages[std::size(STAGE_NAMES)];
+  std::map<std::string, Summary> lock_waits;
+  size_t threads = 0;
+  for (auto *profile = profiles.load(std::memory_order_acquire); profile;
+       profile = profile->next) {
+    ++threads;
+    for (size_t i = 0; i < std::size(stages); ++i) {
+      stages[i].add(profile->stages[i]);
+    }
+    std::lock_guard lock{profile->mtx};
+    for (auto &[name, histogram] : profile->lock_waits) {
+      lock_waits[*name].add(histogram);
+    }
+  }
+
+  std::string out = "profile: " + std::to_string(threads) + " threads\n";
+  out += "stage             count      mean ns     p50 ns     p99 ns   p99.9 ns"
+         "       max ns\n";
+  for (size_t i = 0; i < std::size(stages); ++i) {
+    auto &summary = stages[i];
+    appendRow(out, STAGE_NAMES[i], summary,
+              summary.count ? summary.sum / summary.count : 0);
+  }
+
+  // Most waited-on instruments first.
+  std::vector<std::pair<const std::string *, const Summary *>> instruments;
+  for (auto &[name, summary] : lock_waits) {
+    instruments.emplace_back(&name, &summary);
+  }
+  std::sort(instruments.begin(), instruments.end(),
+            [](auto &a, auto &b) { return a.second->sum > b.second->sum; });
+  out += "lock wait         locks    contended     p50 ns     p99 ns   p99.9 ns"
+         "       max ns\n";
+  for (auto &[name, summary] : instruments) {
+    appendRow(out, name->c_str(), *summary,
+              summary->count - summary->buckets[0]);
+  }
+  fwrite(out.data(), 1, out.size(), stderr);
+}
+
+void Profile::record(ProfileStage stage, intmax_t ns) {
+  local_profile.get().stages[static_cast<size_t>(stage)].record(ns);
+}
+
+void Profile::lock(std::mutex &mtx) {
+  auto *waits = local_profile.get().current;
+  if (mtx.try_lock()) {
+    if (waits) {
+      waits->record(0);
+    }
+    return;
+  }
+  auto start = tsc_clock.now();
+  mtx.lock();
+  if (waits) {
+    // Never 0, so that it doesn't count as uncontended.
+    waits->record(std::max<intmax_t>(tsc_clock.now() - start, 1));
+  }
+}
+
+void Profile::setInstrument(const std::string *name) {
+  auto &profile = local_profile.get();
+  if (!name) {
+    profile.current = nullptr;
+    return;
+  }
+  auto it = profile.lock_waits.find(name);
+  if (it == profile.lock_waits.end()) {
+    std::lock_guard lock{profile.mtx};
+    it = profile.lock_waits.try_emplace(name).first;
+  }
+  profile.current = &it->second;
+}
+
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+
+// Hot-path latency histograms, built with `make PROFILE=1`. Without it every
+// type here is empty and Profile::lock() is a plain lock, so nothing is left
+// in the engine.
+//
+// Each thread records into its own ThreadProfile, so recording takes no lock
+// and touches no shared cache line. The engine prints the totals of all
+// threads to stderr on SIGUSR1 and at exit:
+//
+//   kill -USR1 $(pidof engine)
+//
+// Stages are timed on the TSC clock and overlap: Match includes the lock
+// waits and Output calls made while matching, and Read is one read() on the
+// connection, including the time spent blocked waiting for the client.
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "event_clock.hpp"
+
+enum class ProfileStage : uint8_t {
+  Read,   // one read() of client input
+  Lookup, // finding the instrument, or the resting order of a cancel
+  Match,  // a buy or sell, from taking the execute lock to returning
+  Cancel, // a cancel inside its instrument
+  Amend,  // an amend inside its instrument, including any re-matching
+  Output, // an Output call on the producing thread
+  Format, // formatting one event on the output writer thread
+  COUNT,
+};
+
+#ifdef ENGINE_PROFILE
+
+struct Profile {
+  // Installs the SIGUSR1 and exit dumps. Must run before any other thread is
+  // started, so that SIGUSR1 stays blocked everywhere but the dump thread.
+  static void start();
+  static void dump();
+
+  static void record(ProfileStage stage, intmax_t ns);
+
+  // Locks mtx, recording the wait against the current instrument.
+  static void lock(std::mutex &mtx);
+
+  // The instrument whose lock waits the calling thread records; nullptr for
+  // none.
+  static void setInstrument(const std::string *name);
+};
+
+struct ProfileTimer {
+  ProfileStage stage;
+  intmax_t start = tsc_clock.now();
+
+  explicit ProfileTimer(ProfileStage _stage) : stage{_stage} {}
+  ~ProfileTimer() { Profile::record(stage, tsc_clock.now() - start); }
+
+  ProfileTimer(const ProfileTimer &) = delete;
+  ProfileTimer &operator=(const ProfileTimer &) = delete;
+};
+
+// Attributes lock waits in its scope to the named instrument.
+struct ProfileInstrument {
+  explicit ProfileInstrument(const std::string &name) {
+    Profile::setInstrument(&name);
+  }
+  ~ProfileInstrument() { Profile::setInstrument(nullptr); }
+
+  ProfileInstrument(const ProfileInstrument &) = delete;
+  ProfileInstrument &operator=(const ProfileInstrument &) = delete;
+};
+
+#else
+
+struct Profile {
+  static void start() {}
+  static void dump() {}
+  static void lock(std::mutex &mtx) { mtx.lock(); }
+};
+
+struct ProfileTimer {
+  explicit ProfileTimer(ProfileStage) {}
+};
+
+struct ProfileInstrument {
+  explicit ProfileInstrument(const std::string &) {}
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iterator>
+#include <thread>
+
+#include "engine.hpp"
+#include "reactor.hpp"
+
+Reactor::Reactor(Engine &_engine, unsigned threads) : engine{_engine} {
+  for (unsigned i = 0; i < threads; ++i) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+      perror("epoll_create1");
+      exit(1);
+    }
+    epoll_fds.push_back(epoll_fd);
+    std::thread(&Reactor::run, this, epoll_fd).detach();
+  }
+}
+
+void Reactor::add(ClientConnection connection) {
+  int fd = connection.handle();
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  auto *state = new ClientConnection{std::move(connection)};
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.ptr = state;
+  auto thread = next_thread.fetch_add(1, std::memory_order_relaxed) %
+                static_cast<unsigned>(epoll_fds.size());
+  if (epoll_ctl(epoll_fds[thread], EPOLL_CTL_ADD, fd, &event) != 0) {
+    perror("epoll_ctl");
+    delete state;
+  }
+}
+
+void Reactor::run(int epoll_fd) {
+  constexpr int MAX_EVENTS = 64;
+  epoll_event events[MAX_EVENTS];
+  ClientCommand inputs[ClientConnection::BUFFER_COMMANDS];
+  while (true) {
+    int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      return;
+    }
+
+    for (int i = 0; i < ready; ++i) {
+      auto *connection = static_cast<ClientConnection *>(events[i].data.ptr);
+
+      // Level-triggered: at most one read per wakeup keeps busy connections
+      // from starving the others on this thread. Every whole frame or
+      // command that read brought in is handled now, since nothing would
+      // raise another event for what is left in the buffer.
+      do {
+        size_t count;
+        auto result = connection->readBatch(inputs, std::size(inputs), count);
+        if (result == ReadResult::WouldBlock) {
+          break;
+        }
+        if (result != ReadResult::Success) {
+          if (result == ReadResult::Error) {
+            SyncCerr{} << "Error reading input" << std::endl;
+          }
+          epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->handle(), nullptr);
+          delete connection;
+          break;
+        }
+        engine.handleCommands(inputs, count);
+      } while (connection->hasBuffered());
+    }
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "io.hpp"
+
+struct Engine;
+
+// Serves all client connections from a fixed set of I/O threads, as an
+// alternative to one blocking thread per connection.
+//
+// Each I/O thread owns an epoll instance. Connections are assigned round
+// robin and stay on their thread, so the commands of one connection are
+// still handled in order. Sockets are non-blocking; whatever has arrived is
+// read in one go and every complete frame or command is handed to the
+// engine.
+struct Reactor {
+  Reactor(Engine &_engine, unsigned threads);
+
+  // Takes ownership of the connection.
+  void add(ClientConnection connection);
+
+private:
+  Engine &engine;
+  std::vector<int> epoll_fds;
+  std::atomic<unsigned> next_thread{0};
+
+  void run(int epoll_fd);
+};
@@ -0,0 +1,438 @@
+// Offline replay: runs a command file through the engine without sockets.
+//
+//   make replay
+//   ./replay [-b] [-c] [-S] [-o output] <file>
+//
+//   -b          the file holds binary ClientCommand records (e.g. a journal)
+//               instead of a testcase in the grader's format
+//   -c          after every command, check each instrument's depth(),
+//               bestBid() and bestAsk() against a walk of its resting orders,
+//               and that its book is not crossed; exit with 1 on a mismatch
+//   -S          skip the testcase's sleeps
+//   -o output   write the engine's output to this file; by default it is
+//               discarded
+//
+// A testcase is split into one stream per client thread, as the grader does,
+// and each stream is run on a thread of its own that calls
+// Engine::handleCommand() directly. Barriers and waits are kept, so threads
+// interleave as they would over their connections; opens and disconnects
+// are ignored. A wait returns once the sending thread's handleCommand() for
+// that order has returned, which in EngineMode::SHARDED is when it has been
+// queued rather than matched.
+//
+// A binary file is mapped and run as a single stream, straight out of the
+// mapping.
+//
+// Engine settings are read from the environment as usual, e.g.
+// ENGINE_MODE=sharded, and ENGINE_OUTPUT picks how the -o file is written;
+// ENGINE_OUTPUT=discard together with -o is rejected.
+// The time from starting the streams until every command has been matched
+// is printed to stderr. Built with `make PROFILE=1`, the stage histograms
+// follow at exit.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <latch>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "client_command.hpp"
+#include "config.hpp"
+#include "engine.hpp"
+#include "instrument.hpp"
+
+namespace {
+
+struct Options {
+  bool binary = false;
+  bool checks = false;
+  bool sleeps = true;
+  const char *output = nullptr;
+  const char *path = nullptr;
+};
+
+// Something a stream does between two of its commands.
+struct Directive {
+  enum Kind { Barrier, Sleep, Wait, Signal };
+
+  // Index of the command it runs before.
+  size_t position;
+  Kind kind;
+  // Barrier: index into Sync::barriers; Sleep: milliseconds; Wait and
+  // Signal: index into Sync::sent.
+  size_t value;
+};
+
+struct Stream {
+  const ClientCommand *commands = nullptr;
+  size_t count = 0;
+  std::vector<ClientCommand> storage;
+  std::vector<Directive> directives;
+};
+
+// What the streams of a testcase synchronise on.
+struct Sync {
+  std::deque<std::latch> barriers;
+  // Set once a waited-for order has been handed to the engine.
+  std::unique_ptr<std::atomic<bool>[]> sent;
+};
+
+struct Replay {
+  std::vector<Stream> streams;
+  Sync sync;
+};
+
+[[noreturn]] void fail(const std::string &path, const std::string &line,
+                       const char *reason) {
+  fprintf(stderr, "%s: %s: %s\n", path.c_str(), reason, line.c_str());
+  exit(1);
+}
+
+Replay loadTestcase(const Options &options) {
+  std::ifstream input{options.path};
+  if (!input) {
+    perror(options.path);
+    exit(1);
+  }
+  std::string line;
+  unsigned thread_count = 0;
+  while (std::getline(input, line)) {
+    if (!line.empty() && line[0] != '#') {
+      thread_count = static_cast<unsigned>(std::stoul(line));
+      break;
+    }
+  }
+  if (!thread_count) {
+    fprintf(stderr, "%s: missing thread count\n", options.path);
+    exit(1);
+  }
+
+  Replay replay;
+  replay.streams.resize(thread_count);
+  std::vector<unsigned> all_threads(thread_count);
+  for (unsigned thread = 0; thread < thread_count; ++thread) {
+    all_threads[thread] = thread;
+  }
+  // Where each buy and sell was sent, and the orders some thread waits for.
+  struct Sender {
+    unsigned thread;
+    size_t position;
+  };
+  std::unordered_map<uint32_t, Sender> senders;
+  std::unordered_map<uint32_t, size_t> waited;
+
+  while (std::getline(input, line)) {
+    std::vector<unsigned> threads;
+    const char *text = line.c_str();
+    auto space = line.find(' ');
+    if (space != std::string::npos && isdigit(line[0]) &&
+        parseThreadSpec(line.substr(0, space), threads)) {
+      text += space + 1;
+    } else {
+      threads = all_threads;
+    }
+    std::sort(threads.begin(), threads.end());
+    threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+    if (!threads.empty() && threads.back() >= thread_count) {
+      fail(options.path, line, "no such thread");
+    }
+
+    auto directive = [&](Directive::Kind kind, size_t value) {
+      for (auto thread : threads) {
+        auto &stream = replay.streams[thread];
+        stream.directives.push_back({stream.storage.size(), kind, value});
+      }
+    };
+    switch (text[0]) {
+    case '.':
+      directive(Directive::Barrier, replay.sync.barriers.size());
+      replay.sync.barriers.emplace_back(
+          static_cast<std::ptrdiff_t>(threads.size()));
+      continue;
+    case 's':
+      directive(Directive::Sleep, strtoul(text + 1, nullptr, 10));
+      continue;
+    case 'w': {
+      auto id = static_cast<uint32_t>(strtoul(text + 1, nullptr, 10));
+      directive(Directive::Wait,
+                waited.try_emplace(id, waited.size()).first->second);
+      continue;
+    }
+    case 'o':
+    case 'x':
+      continue;
+    }
+
+    ClientCommand command;
+    switch (parseClientCommand(text, command)) {
+    case ParseResult::Command:
+      for (auto thread : threads) {
+        auto &stream = replay.streams[thread];
+        if (command.type != input_cancel && command.type != input_amend) {
+          senders[command.order_id] = {thread, stream.storage.size()};
+        }
+        stream.storage.push_back(command);
+      }
+      break;
+    case ParseResult::Skip:
+      break;
+    default:
+      fail(options.path, line, "invalid command");
+    }
+  }
+
+  // Each waited-for order signals right after its sender has handled it,
+  // ahead of anything else the sender does at that point.
+  replay.sync.sent = std::make_unique<std::atomic<bool>[]>(waited.size());
+  for (auto &[id, slot] : waited) {
+    auto sender = senders.find(id);
+    if (sender == senders.end()) {
+      fail(options.path, "w " + std::to_string(id),
+           "waits for an unsent order");
+    }
+    auto &directives = replay.streams[sender->second.thread].directives;
+    auto position = sender->second.position + 1;
+    auto at = std::lower_bound(
+        directives.begin(), directives.end(), position,
+        [](const Directive &d, size_t p) { return d.position < p; });
+    directives.insert(at, {position, Directive::Signal, slot});
+  }
+  for (auto &stream : replay.streams) {
+    stream.commands = stream.storage.data();
+    stream.count = stream.storage.size();
+  }
+  return replay;
+}
+
+Replay loadBinary(const Options &options) {
+  int fd = open(options.path, O_RDONLY);
+  struct stat status;
+  if (fd == -1 || fstat(fd, &status) != 0) {
+    perror(options.path);
+    exit(1);
+  }
+  Replay replay;
+  auto &stream = replay.streams.emplace_back();
+  // A torn last record is left out, as when a journal is reopened.
+  stream.count = static_cast<size_t>(status.st_size) / sizeof(ClientCommand);
+  if (stream.count) {
+    auto size = stream.count * sizeof(ClientCommand);
+    auto *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      perror(options.path);
+      exit(1);
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    stream.commands = static_cast<const ClientCommand *>(data);
+  }
+  close(fd);
+  return replay;
+}
+
+void runDirective(const Directive &directive, Sync &sync, bool sleeps) {
+  switch (directive.kind) {
+  case Directive::Barrier:
+    sync.barriers[directive.value].arrive_and_wait();
+    break;
+  case Directive::Sleep:
+    if (sleeps) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{directive.value});
+    }
+    break;
+  case Directive::Wait:
+    while (!sync.sent[directive.value].load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+    break;
+  case Directive::Signal:
+    sync.sent[directive.value].store(true, std::memory_order_release);
+    break;
+  }
+}
+
+void printLevels(const char *what, const std::vector<DepthLevel> &levels) {
+  fprintf(stderr, "  %s:", what);
+  for (auto &level : levels) {
+    fprintf(stderr, " %u/%u/%llu", level.price, level.orders,
+            static_cast<unsigned long long>(level.quantity));
+  }
+  fprintf(stderr, "\n");
+}
+
+// Whether the level queries of instrument agree with the levels found by
+// walking its resting orders, and its sides do not cross. What does not is
+// reported to stderr.
+bool checkLevels(InstrumentNew &instrument) {
+  std::map<uint32_t, DepthLevel> walked[2];
+  instrument.forEachOrder([&](const OrderNew &order, bool is_sell) {
+    auto &level = walked[is_sell][order.price];
+    level.price = order.price;
+    ++level.orders;
+    level.quantity += order.count;
+  });
+  auto *name = instrument.name.c_str();
+  bool ok = true;
+  for (bool is_sell : {false, true}) {
+    std::vector<DepthLevel> expected;
+    for (auto &[price, level] : walked[is_sell]) {
+      expected.push_back(level);
+    }
+    if (!is_sell) {
+      // Best bid first.
+      std::reverse(expected.begin(), expected.end());
+    }
+    // Room for one more level than the walk found, should depth() have it.
+    std::vector<DepthLevel> levels(expected.size() + 1);
+    levels.resize(instrument.depth(is_sell, levels.data(), levels.size()));
+    auto best = is_sell ? instrument.bestAsk() : instrument.bestBid();
+    if (levels != expected ||
+        best != (expected.empty() ? DepthLevel{0, 0, 0} : expected.front())) {
+      fprintf(stderr, "%s: %s levels differ from the resting orders\n", name,
+              is_sell ? "ask" : "bid");
+      printLevels("depth()", levels);
+      printLevels("best", {best});
+      printLevels("orders", expected);
+      ok = false;
+    }
+  }
+  if (!walked[0].empty() && !walked[1].empty() &&
+      walked[0].rbegin()->first >= walked[1].begin()->first) {
+    fprintf(stderr, "%s: bid %u crosses ask %u\n", name,
+            walked[0].rbegin()->first, walked[1].begin()->first);
+    ok = false;
+  }
+  return ok;
+}
+
+void checkBook(Engine &engine, const ClientCommand &command) {
+  std::atomic<bool> ok{true};
+  engine.forEachInstrument([&](InstrumentNew &instrument) {
+    if (!checkLevels(instrument)) {
+      ok.store(false, std::memory_order_relaxed);
+    }
+  });
+  if (!ok) {
+    fprintf(stderr, "replay: book check failed after order %u\n",
+            command.order_id);
+    exit(1);
+  }
+}
+
+void runStream(Engine &engine, const Stream &stream, Sync &sync,
+               const Options &options) {
+  auto directive = stream.directives.begin();
+  auto end = stream.directives.end();
+  for (size_t i = 0; i < stream.count; ++i) {
+    for (; directive != end && directive->position == i; ++directive) {
+      runDirective(*directive, sync, options.sleeps);
+    }
+    engine.handleCommand(stream.commands[i]);
+    if (options.checks) {
+      checkBook(engine, stream.commands[i]);
+    }
+  }
+  for (; directive != end; ++directive) {
+    runDirective(*directive, sync, options.sleeps);
+  }
+}
+
+Options parseOptions(int argc, char *argv[]) {
+  Options options;
+  int opt;
+  while ((opt = getopt(argc, argv, "bcSo:")) != -1) {
+    switch (opt) {
+    case 'b':
+      options.binary = true;
+      break;
+    case 'c':
+      options.checks = true;
+      break;
+    case 'S':
+      options.sleeps = false;
+      break;
+    case 'o':
+      options.output = optarg;
+      break;
+    default:
+      optind = argc + 1;
+      break;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [-b] [-c] [-S] [-o output] <file>\n", argv[0]);
+    exit(1);
+  }
+  options.path = argv[optind];
+  return options;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  auto options = parseOptions(argc, argv);
+  auto replay = options.binary ? loadBinary(options) : loadTestcase(options);
+
+  auto mode = EngineConfig::fromEnvironment().output;
+  if (options.output && mode == OutputMode::Discard) {
+    fprintf(stderr, "%s: -o %s conflicts with ENGINE_OUTPUT=discard\n",
+            argv[0], options.output);
+    return 1;
+  }
+
+  // Like main.cpp, the engine is never destroyed.
+  auto *engine = new Engine();
+  if (options.output) {
+    // Onto stdout, which is where OutputMode::Sync writes.
+    int fd = open(options.output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || dup2(fd, 1) == -1) {
+      perror(options.output);
+      return 1;
+    }
+    close(fd);
+    Output::configure(mode);
+  } else {
+    Output::configure(OutputMode::Discard);
+  }
+
+  size_t commands = 0;
+  for (auto &stream : replay.streams) {
+    commands += stream.count;
+  }
+  std::latch ready{static_cast<std::ptrdiff_t>(replay.streams.size()) + 1};
+  std::vector<std::thread> threads;
+  for (auto &stream : replay.streams) {
+    threads.emplace_back([&] {
+      ready.arrive_and_wait();
+      runStream(*engine, stream, replay.sync, options);
+    });
+  }
+  ready.arrive_and_wait();
+  auto start = std::chrono::steady_clock::now();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  engine->drain();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  fprintf(stderr, "replay: %zu commands on %zu threads in %.3f ms, %.0f/s\n",
+          commands, replay.streams.size(), elapsed.count() * 1e3,
+          static_cast<double>(commands) / elapsed.count());
+  return 0;
+}
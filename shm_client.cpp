@@ -0,0 +1,109 @@
+// Like client.cpp, but hands the commands to the engine through shared
+// memory (see shm_transport.hpp) instead of writing them to the socket.
+// Exits once the engine has answered every command, so timing a run
+// measures the whole transport.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iterator>
+#include <thread>
+
+#include "client_command.hpp"
+#include "io.hpp"
+#include "shm_transport.hpp"
+
+static char* line_buffer;
+static size_t line_buffer_size = 0;
+
+static int socket_fd = -1;
+static ShmRegion* region = NULL;
+static size_t sent = 0;
+static size_t answered = 0;
+
+static void check_engine()
+{
+	struct pollfd pfd {};
+	pfd.fd = socket_fd;
+	pfd.events = POLLIN | POLLRDHUP;
+	if(poll(&pfd, 1, 0) == 1)
+	{
+		fprintf(stderr, "Connection closed by server\n");
+		_exit(0);
+	}
+}
+
+static void drain_responses()
+{
+	ShmResponse responses[256];
+	size_t count;
+	while((count = region->responses.tryPop(responses, std::size(responses))) != 0)
+		answered += count;
+}
+
+static void send_command(const ClientCommand& input)
+{
+	while(region->commands.tryPush(&input, 1) == 0)
+	{
+		// The engine is behind; make room for its responses meanwhile.
+		drain_responses();
+		check_engine();
+		std::this_thread::yield();
+	}
+	++sent;
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <path of the engine's shared memory socket> < <input>\n", argv[0]);
+		return 1;
+	}
+
+	region = connectShm(argv[1], socket_fd);
+	if(!region)
+		return 1;
+
+	auto start = std::chrono::steady_clock::now();
+	while(1)
+	{
+		ClientCommand input {};
+
+		ssize_t line_length = getline(&line_buffer, &line_buffer_size, stdin);
+		if(line_length == -1)
+			break;
+
+		switch(parseClientCommand(line_buffer, input))
+		{
+			case ParseResult::Command: break;
+			case ParseResult::Skip: continue;
+			case ParseResult::InvalidCancel: fprintf(stderr, "Invalid cancel order: %s\n", line_buffer); return 1;
+			case ParseResult::InvalidNew: fprintf(stderr, "Invalid new order: %s\n", line_buffer); return 1;
+			case ParseResult::InvalidAmend: fprintf(stderr, "Invalid amend order: %s\n", line_buffer); return 1;
+			case ParseResult::InvalidCommand: fprintf(stderr, "Invalid command '%c'\n", line_buffer[0]); return 1;
+		}
+
+		send_command(input);
+		drain_responses();
+	}
+
+	const timespec idle_check {0, 100'000'000};
+	while(answered < sent)
+	{
+		if(!region->responses.wait(defaultShmSpins(), idle_check))
+			check_engine();
+		drain_responses();
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	fprintf(stderr, "%zu commands answered in %.3f ms\n", sent, elapsed.count() * 1e3);
+	close(socket_fd);
+
+	return ferror(stderr) ? 1 : 0;
+}
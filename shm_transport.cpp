@@ -0,0 +1,122 @@
+#include "shm_transport.hpp"
+
+#include <poll.h>
+#include <sys/stat.h>
+
+#include <iterator>
+#include <thread>
+
+#include "engine.hpp"
+
+namespace {
+
+// How long an idle side sleeps before checking whether its peer is gone.
+constexpr timespec IDLE_CHECK{0, 100'000'000};
+
+// Whether the client has closed its end of the socket.
+bool hungUp(int fd) {
+  pollfd peer{fd, POLLIN | POLLRDHUP, 0};
+  return poll(&peer, 1, 0) == 1 &&
+         (peer.revents & (POLLIN | POLLRDHUP | POLLHUP | POLLERR));
+}
+
+// Receives the client's memfd and maps it. Returns nullptr if the client
+// sent anything else, or a memfd without SHM_SEALS.
+ShmRegion *receiveRegion(int fd) {
+  char byte;
+  iovec data{&byte, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+  msghdr message{};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  if (recvmsg(fd, &message, MSG_CMSG_CLOEXEC) != 1) {
+    return nullptr;
+  }
+  auto *header = CMSG_FIRSTHDR(&message);
+  if (!header || header->cmsg_level != SOL_SOCKET ||
+      header->cmsg_type != SCM_RIGHTS ||
+      header->cmsg_len != CMSG_LEN(sizeof(int))) {
+    return nullptr;
+  }
+  int memfd;
+  memcpy(&memfd, CMSG_DATA(header), sizeof(int));
+
+  struct stat status;
+  void *memory = MAP_FAILED;
+  int seals = fcntl(memfd, F_GET_SEALS);
+  if (seals != -1 && (seals & SHM_SEALS) == SHM_SEALS &&
+      fstat(memfd, &status) == 0 &&
+      static_cast<size_t>(status.st_size) == sizeof(ShmRegion)) {
+    memory = mmap(nullptr, sizeof(ShmRegion), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, memfd, 0);
+  }
+  close(memfd);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  auto *region = static_cast<ShmRegion *>(memory);
+  if (region->magic != ShmRegion::MAGIC ||
+      region->version != ShmRegion::VERSION) {
+    munmap(memory, sizeof(ShmRegion));
+    return nullptr;
+  }
+  return region;
+}
+
+// Handles the client's commands until it hangs up, or stops draining its
+// responses and then hangs up.
+void serveClient(Engine &engine, int fd, ShmRegion *region, unsigned spins) {
+  ClientCommand inputs[FrameHeader::MAX_COMMANDS];
+  ShmResponse responses[FrameHeader::MAX_COMMANDS];
+  while (true) {
+    auto count = region->commands.tryPop(inputs, std::size(inputs));
+    if (!count) {
+      if (!region->commands.wait(spins, IDLE_CHECK) && hungUp(fd)) {
+        break;
+      }
+      continue;
+    }
+
+    engine.handleCommands(inputs, count);
+    for (size_t i = 0; i < count; ++i) {
+      responses[i] = {inputs[i].order_id, inputs[i].type};
+    }
+    for (size_t sent = 0; sent < count;) {
+      sent += region->responses.tryPush(responses + sent, count - sent);
+      if (sent < count) {
+        if (hungUp(fd)) {
+          break;
+        }
+        std::this_thread::yield();
+      }
+    }
+  }
+  munmap(region, sizeof(ShmRegion));
+  close(fd);
+}
+
+} // namespace
+
+void serveShm(Engine &engine, int listenfd, unsigned spins) {
+  std::thread([&engine, listenfd, spins] {
+    while (true) {
+      int fd = accept4(listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd == -1) {
+        perror("accept");
+        return;
+      }
+      auto *region = receiveRegion(fd);
+      if (!region || write(fd, &SHM_ACCEPTED, 1) != 1) {
+        SyncCerr{} << "Rejected shared memory client" << std::endl;
+        if (region) {
+          munmap(region, sizeof(ShmRegion));
+        }
+        close(fd);
+        continue;
+      }
+      std::thread(serveClient, std::ref(engine), fd, region, spins).detach();
+    }
+  }).detach();
+}
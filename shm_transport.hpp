@@ -0,0 +1,213 @@
+#pragma once
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include "io.hpp"
+
+struct Engine;
+
+// Shared-memory transport for clients on the same host as the engine.
+//
+// The client creates a ShmRegion in a memfd and hands the fd to the engine
+// over the engine's shared-memory socket (ENGINE_SHM_SOCKET) with
+// SCM_RIGHTS, sealed so that its size can no longer change; the engine
+// checks the seals, maps it, answers with one byte, and from then on a
+// thread of its own serves the region. Commands go through an SPSC ring and
+// are handled in batches, like a frame from a socket. For every command the
+// engine has handled, it pushes a ShmResponse onto a second ring, which the
+// client must drain. The socket is kept open only so that each side notices
+// when the other goes away.
+//
+// An empty ring is busy-polled for a while and then slept on with a futex on
+// its tail, which the producer wakes when it sees the sleeping flag.
+// Neither side makes a syscall while the other keeps up.
+
+// Bounded single-producer single-consumer ring that lives in shared memory,
+// so it only holds positions and items, and waits with process-shared
+// futexes.
+template <typename T, uint32_t CAPACITY> struct ShmRing {
+  static_assert(std::has_single_bit(CAPACITY));
+  static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+  // Consumer side.
+  alignas(64) std::atomic<uint32_t> head{0};
+  // Producer side.
+  alignas(64) std::atomic<uint32_t> tail{0};
+  // Set while the consumer sleeps, or is about to, on tail.
+  alignas(64) std::atomic<uint32_t> sleeping{0};
+  alignas(64) T items[CAPACITY];
+
+  // Producer only. Copies in as many of the count items as fit and returns
+  // how many that was.
+  size_t tryPush(const T *values, size_t count) {
+    auto position = tail.load(std::memory_order_relaxed);
+    auto free = CAPACITY - (position - head.load(std::memory_order_acquire));
+    auto n = static_cast<uint32_t>(std::min<size_t>(count, free));
+    for (uint32_t i = 0; i < n; ++i) {
+      items[(position + i) & (CAPACITY - 1)] = values[i];
+    }
+    if (n) {
+      tail.store(position + n, std::memory_order_release);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (sleeping.load(std::memory_order_relaxed)) {
+        futex(FUTEX_WAKE, 1, nullptr);
+      }
+    }
+    return n;
+  }
+
+  // Consumer only. Copies out up to max_count items and returns how many.
+  size_t tryPop(T *values, size_t max_count) {
+    auto position = head.load(std::memory_order_relaxed);
+    auto available = tail.load(std::memory_order_acquire) - position;
+    auto n = static_cast<uint32_t>(std::min<size_t>(max_count, available));
+    for (uint32_t i = 0; i < n; ++i) {
+      values[i] = items[(position + i) & (CAPACITY - 1)];
+    }
+    head.store(position + n, std::memory_order_release);
+    return n;
+  }
+
+  // Consumer only. Returns once the ring is not empty, or false once it has
+  // stayed empty for spins polls and then timeout.
+  bool wait(unsigned spins, const timespec &timeout) {
+    for (unsigned i = 0; i < spins; ++i) {
+      if (!empty()) {
+        return true;
+      }
+    }
+    auto seen = tail.load(std::memory_order_relaxed);
+    sleeping.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (seen == head.load(std::memory_order_relaxed)) {
+      futex(FUTEX_WAIT, seen, &timeout);
+    }
+    sleeping.store(0, std::memory_order_relaxed);
+    return !empty();
+  }
+
+  bool empty() const {
+    return tail.load(std::memory_order_acquire) ==
+           head.load(std::memory_order_relaxed);
+  }
+
+private:
+  // Not FUTEX_PRIVATE_FLAG: the other side maps the ring at another address
+  // in another process.
+  void futex(int op, uint32_t value, const timespec *timeout) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&tail), op, value,
+            timeout, nullptr, 0);
+  }
+};
+
+// The engine's answer for each command it has handled. In
+// EngineMode::SHARDED that is once the command is queued for its worker.
+struct ShmResponse {
+  uint32_t order_id;
+  CommandType type;
+};
+
+struct ShmRegion {
+  static constexpr uint32_t MAGIC = 'S' | 'H' << 8 | 'M' << 16 | 'R' << 24;
+  static constexpr uint32_t VERSION = 1;
+  static constexpr uint32_t RING_CAPACITY = 4096;
+
+  uint32_t magic = MAGIC;
+  uint32_t version = VERSION;
+  ShmRing<ClientCommand, RING_CAPACITY> commands;
+  ShmRing<ShmResponse, RING_CAPACITY> responses;
+};
+
+// How often an idle consumer polls its ring before sleeping. Polling only
+// pays if the producer runs on another CPU meanwhile.
+inline unsigned defaultShmSpins() {
+  return std::thread::hardware_concurrency() > 1 ? 1u << 14 : 0;
+}
+
+// Seals the engine requires on a region's memfd: a client that could still
+// shrink it could make the engine's next access to the rings fault.
+constexpr int SHM_SEALS = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+// What the engine sends back once it has mapped a region.
+constexpr char SHM_ACCEPTED = 'A';
+
+// Serves the clients connecting to listenfd from threads of their own;
+// returns at once. An empty ring is polled spins times before its consumer
+// sleeps.
+void serveShm(Engine &engine, int listenfd, unsigned spins);
+
+// Client side: creates a region, hands it to the engine listening on path
+// and returns it once accepted, with the socket in socket_fd. Returns
+// nullptr after printing why if any step fails.
+inline ShmRegion *connectShm(const char *path, int &socket_fd) {
+  int memfd = memfd_create("engine-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd == -1 || ftruncate(memfd, sizeof(ShmRegion)) != 0 ||
+      fcntl(memfd, F_ADD_SEALS, SHM_SEALS) != 0) {
+    perror("memfd");
+    if (memfd != -1) {
+      close(memfd);
+    }
+    return nullptr;
+  }
+  auto *memory = mmap(nullptr, sizeof(ShmRegion), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, memfd, 0);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    close(memfd);
+    return nullptr;
+  }
+  auto *region = new (memory) ShmRegion;
+
+  socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+  if (socket_fd == -1 ||
+      connect(socket_fd, reinterpret_cast<sockaddr *>(&address),
+              sizeof(address)) != 0) {
+    perror("connect");
+    close(memfd);
+    munmap(memory, sizeof(ShmRegion));
+    return nullptr;
+  }
+
+  char byte = 0;
+  iovec data{&byte, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr message{};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  auto *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(header), &memfd, sizeof(int));
+  bool accepted = sendmsg(socket_fd, &message, 0) == 1 &&
+                  read(socket_fd, &byte, 1) == 1 && byte == SHM_ACCEPTED;
+  close(memfd);
+  if (!accepted) {
+    fprintf(stderr, "%s: shared memory region not accepted\n", path);
+    close(socket_fd);
+    munmap(memory, sizeof(ShmRegion));
+    return nullptr;
+  }
+  return region;
+}
@@ -0,0 +1,221 @@
+#include "snapshot.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "io.hpp"
+#include "journal.hpp"
+#include "matching_workers.hpp"
+#include "order_book.hpp"
+
+namespace {
+
+struct CapturedInstrument {
+  SnapshotInstrument info;
+  std::vector<SnapshotOrder> orders;
+};
+
+// Copies an instrument that is held still by the caller.
+CapturedInstrument capture(InstrumentNew &instrument, const Journal *journal) {
+  CapturedInstrument captured{};
+  memcpy(captured.info.symbol, instrument.name.data(),
+         std::min(instrument.name.size(), sizeof(captured.info.symbol)));
+  instrument.forEachOrder([&](const OrderNew &order, bool is_sell) {
+    captured.orders.push_back(
+        {order.id, order.price, order.count, order.execution_id});
+    ++(is_sell ? captured.info.sells : captured.info.buys);
+  });
+  captured.info.clock = instrument.timestamp.last.load();
+  captured.info.journal_records = journal ? journal->position() : 0;
+  return captured;
+}
+
+bool writeAll(int fd, const void *data, size_t size) {
+  auto *bytes = static_cast<const char *>(data);
+  while (size) {
+    auto written = write(fd, bytes, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    bytes += written;
+    size -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+bool saveSnapshot(OrderBookNew &book, MatchingWorkers *workers,
+                  const char *path) {
+  auto start = std::chrono::steady_clock::now();
+  std::mutex captured_mtx;
+  std::vector<CapturedInstrument> captured;
+  auto keep = [&](CapturedInstrument &&instrument) {
+    std::lock_guard lock{captured_mtx};
+    captured.push_back(std::move(instrument));
+  };
+  auto *journal = book.journal;
+  SnapshotHeader header{};
+  header.journal_records =
+      journal ? journal->position() : SnapshotHeader::NOT_JOURNALED;
+  if (workers) {
+    workers->forEachInstrument([&](InstrumentNew &instrument) {
+      keep(capture(instrument, journal));
+    });
+  } else {
+    book.instruments.forEach([&](InstrumentNew &instrument) {
+      // Every buy, sell and cancel holds one of these for its whole run,
+      // or in EngineMode::COMBINING runs under the combiner lock. The
+      // journal lock also covers appending the command to the journal.
+      std::scoped_lock lock{instrument.execute_buy_lk,
+                            instrument.execute_sell_lk, instrument.insert_lk,
+                            instrument.combiner.combine_lk,
+                            instrument.journal_lk};
+      keep(capture(instrument, journal));
+    });
+  }
+
+  memcpy(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic));
+  header.version = SnapshotHeader::VERSION;
+  header.instruments = static_cast<uint32_t>(captured.size());
+  header.book_clock = book.timestamp.last.load();
+  header.clock = std::max<int64_t>(tsc_clock.now(), header.book_clock);
+  std::vector<SnapshotInstrument> infos;
+  uint64_t journal_records = 0;
+  for (auto &instrument : captured) {
+    header.orders += instrument.orders.size();
+    header.clock = std::max(header.clock, instrument.info.clock);
+    journal_records =
+        std::max(journal_records, instrument.info.journal_records);
+    infos.push_back(instrument.info);
+  }
+  if (journal) {
+    // Never let the snapshot get ahead of the journal on disk.
+    journal->sync(journal_records);
+  }
+
+  auto temporary = std::string{path} + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    SyncCerr{} << "snapshot: cannot create " << temporary << ": "
+               << strerror(errno) << std::endl;
+    return false;
+  }
+  bool ok = writeAll(fd, &header, sizeof(header)) &&
+            writeAll(fd, infos.data(), infos.size() * sizeof(infos[0]));
+  for (auto &instrument : captured) {
+    ok = ok && writeAll(fd, instrument.orders.data(),
+                        instrument.orders.size() * sizeof(SnapshotOrder));
+  }
+  ok = ok && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(temporary.c_str(), path) != 0) {
+    SyncCerr{} << "snapshot: cannot write " << path << ": " << strerror(errno)
+               << std::endl;
+    unlink(temporary.c_str());
+    return false;
+  }
+  SyncCerr{} << "snapshot: saved " << header.orders << " orders of "
+             << header.instruments << " instruments to " << path << " in "
+             << millisecondsSince(start) << " ms" << std::endl;
+  return true;
+}
+
+bool loadSnapshot(OrderBookNew &book, const char *path, ReplayStart &replay) {
+  auto start = std::chrono::steady_clock::now();
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 ||
+      static_cast<size_t>(status.st_size) < sizeof(SnapshotHeader)) {
+    close(fd);
+    SyncCerr{} << "snapshot: " << path << " is truncated" << std::endl;
+    return false;
+  }
+  auto size = static_cast<size_t>(status.st_size);
+  auto *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    SyncCerr{} << "snapshot: cannot map " << path << ": " << strerror(errno)
+               << std::endl;
+    return false;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  auto &header = *static_cast<const SnapshotHeader *>(data);
+  auto *infos = static_cast<const SnapshotInstrument *>(
+      static_cast<const void *>(&header + 1));
+
+  // Check everything before restoring anything.
+  bool valid = memcmp(header.magic, SnapshotHeader::MAGIC,
+                      sizeof(header.magic)) == 0 &&
+               header.version == SnapshotHeader::VERSION &&
+               header.orders <= size / sizeof(SnapshotOrder) &&
+               size == sizeof(header) +
+                           header.instruments * sizeof(SnapshotInstrument) +
+                           header.orders * sizeof(SnapshotOrder);
+  auto *orders = static_cast<const SnapshotOrder *>(
+      static_cast<const void *>(infos + (valid ? header.instruments : 0)));
+  uint64_t total = 0;
+  for (uint32_t i = 0; valid && i < header.instruments; ++i) {
+    total += uint64_t{infos[i].buys} + infos[i].sells;
+  }
+  valid = valid && total == header.orders;
+  for (uint64_t i = 0; valid && i < header.orders; ++i) {
+    valid = orders[i].count != 0;
+  }
+  if (!valid) {
+    munmap(data, size);
+    SyncCerr{} << "snapshot: " << path << " is not a valid snapshot"
+               << std::endl;
+    return false;
+  }
+
+  auto *order = orders;
+  for (uint32_t i = 0; i < header.instruments; ++i) {
+    auto &info = infos[i];
+    char name[sizeof(info.symbol) + 1] = {};
+    memcpy(name, info.symbol, sizeof(info.symbol));
+    auto &instrument = book.ensureInstrumentExists(name);
+    for (uint64_t j = 0; j < uint64_t{info.buys} + info.sells; ++j, ++order) {
+      instrument.restoreOrder({order->id, order->price, order->count,
+                               order->execution_id, NULL_HANDLE, NULL_HANDLE,
+                               nullptr},
+                              j >= info.buys);
+    }
+    instrument.timestamp.last.store(info.clock);
+    replay.instruments[packSymbol(name)] = info.journal_records;
+  }
+  replay.journaled = header.journal_records != SnapshotHeader::NOT_JOURNALED;
+  replay.rejects = replay.journaled ? header.journal_records : 0;
+  book.timestamp.last.store(header.book_clock);
+  // Resume after the last timestamp of the previous run, keeping every
+  // clock in step with tsc_clock.
+  tsc_clock.offset += std::max<intmax_t>(0, header.clock + 1 - tsc_clock.now());
+
+  SyncCerr{} << "snapshot: restored " << header.orders << " orders of "
+             << header.instruments << " instruments from " << path << " in "
+             << millisecondsSince(start) << " ms" << std::endl;
+  munmap(data, size);
+  return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+// Snapshots of the whole book, for restarting without replaying traffic.
+//
+// A snapshot file is a flat array of fixed-size records, so it is read
+// straight out of an mmap:
+//
+//   SnapshotHeader
+//   SnapshotInstrument[header.instruments]
+//   SnapshotOrder[header.orders]
+//
+// Each instrument's orders follow those of the instrument before it, its buys
+// first and then its sells, in queue order within every price level. The
+// order index is not stored: restoring the orders rebuilds it.
+//
+// Instruments are captured one at a time, each while it is held still (by
+// its locks, which include its combiner's in EngineMode::COMBINING, or by
+// its matching worker in EngineMode::SHARDED), so matching only pauses on
+// the instrument being copied. Each instrument is consistent in itself;
+// orders of different instruments may be captured at slightly different
+// times. When the book is journaled, each instrument also records the journal
+// position it was captured at, and the snapshot is only saved once the
+// journal is committed up to every such position, so that a replay of the
+// journal on top of the snapshot picks up exactly where each instrument left
+// off (see ReplayStart).
+
+#include <cstdint>
+
+struct MatchingWorkers;
+struct OrderBookNew;
+struct ReplayStart;
+
+struct SnapshotHeader {
+  static constexpr char MAGIC[8] = {'O', 'B', 'S', 'N', 'A', 'P', '\0', '\0'};
+  static constexpr uint32_t VERSION = 2;
+  // journal_records of a snapshot of a book that was not journaled.
+  static constexpr uint64_t NOT_JOURNALED = UINT64_MAX;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t instruments;
+  uint64_t orders;
+  // Clock of events outside any instrument, and the largest timestamp
+  // handed out anywhere when the snapshot was taken.
+  int64_t book_clock;
+  int64_t clock;
+  // Journal position when the capture started; rejects of unknown orders
+  // before it are not replayed.
+  uint64_t journal_records;
+};
+
+struct SnapshotInstrument {
+  char symbol[8];
+  int64_t clock;
+  uint32_t buys;
+  uint32_t sells;
+  // Journal position when the instrument was captured.
+  uint64_t journal_records;
+};
+
+struct SnapshotOrder {
+  uint32_t id;
+  uint32_t price;
+  uint32_t count;
+  uint32_t execution_id;
+};
+
+// Writes a snapshot of book to path, through a temporary file that replaces
+// path once complete. workers must be given in EngineMode::SHARDED. Returns
+// false and leaves path untouched on errors.
+bool saveSnapshot(OrderBookNew &book, MatchingWorkers *workers,
+                  const char *path);
+
+// Restores a snapshot into an empty book and moves tsc_clock past every
+// timestamp of the previous run, and fills replay with where to resume
+// replaying the journal the snapshot was taken with. Must be called before
+// any other thread uses the book or the clock. Returns false if path is
+// missing or invalid, in which case the book stays empty.
+bool loadSnapshot(OrderBookNew &book, const char *path, ReplayStart &replay);
@@ -0,0 +1,381 @@
+#include "uring.hpp"
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+// Multishot recv is the newest piece used here; headers that have it also
+// have provided buffer rings (which are an enum, not a macro).
+#ifdef IORING_RECV_MULTISHOT
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#include "engine.hpp"
+
+namespace {
+
+constexpr uint64_t ACCEPT_TAG = 0;
+constexpr uint16_t BUFFER_GROUP = 0;
+// Power of two, as required for provided buffer rings.
+constexpr unsigned BUFFER_COUNT = 256;
+constexpr unsigned BUFFER_SIZE =
+    ClientConnection::BUFFER_COMMANDS * sizeof(ClientCommand);
+
+// Raw io_uring: the three shared mappings and the provided buffer ring.
+struct Ring {
+  int fd = -1;
+
+  void *rings = MAP_FAILED;
+  size_t rings_size = 0;
+  io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+  size_t sqes_size = 0;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  io_uring_cqe *cqes;
+
+  // Local SQ tail and how much of it the kernel has been told about.
+  unsigned sq_local_tail = 0;
+  unsigned sq_submitted = 0;
+
+  io_uring_buf_ring *buffer_ring = static_cast<io_uring_buf_ring *>(MAP_FAILED);
+  char *buffers = static_cast<char *>(MAP_FAILED);
+  uint16_t buffer_tail = 0;
+
+  ~Ring() {
+    if (buffers != MAP_FAILED) {
+      munmap(buffers, size_t{BUFFER_COUNT} * BUFFER_SIZE);
+    }
+    if (buffer_ring != MAP_FAILED) {
+      munmap(buffer_ring, BUFFER_COUNT * sizeof(io_uring_buf));
+    }
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, sqes_size);
+    }
+    if (rings != MAP_FAILED) {
+      munmap(rings, rings_size);
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  bool setup(unsigned entries, unsigned cq_entries) {
+    io_uring_params params{};
+#ifdef IORING_SETUP_DEFER_TASKRUN
+    // Completions are only ever reaped by this thread, so the kernel can
+    // defer its work for them until we ask for completions.
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+                   IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = cq_entries;
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd == -1 && errno == EINVAL) {
+      // Kernels before 6.1 don't know these flags.
+      params = {};
+    }
+#endif
+    if (fd == -1) {
+      params.flags = IORING_SETUP_CQSIZE;
+      params.cq_entries = cq_entries;
+      fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    }
+    if (fd == -1 || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+      return false;
+    }
+
+    rings_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                          params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    rings = mmap(nullptr, rings_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size,
+                                            PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, fd,
+                                            IORING_OFF_SQES));
+    if (rings == MAP_FAILED || sqes == MAP_FAILED) {
+      return false;
+    }
+
+    sq_head = at<unsigned>(params.sq_off.head);
+    sq_tail = at<unsigned>(params.sq_off.tail);
+    sq_array = at<unsigned>(params.sq_off.array);
+    sq_mask = *at<unsigned>(params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    cq_head = at<unsigned>(params.cq_off.head);
+    cq_tail = at<unsigned>(params.cq_off.tail);
+    cq_mask = *at<unsigned>(params.cq_off.ring_mask);
+    cqes = at<io_uring_cqe>(params.cq_off.cqes);
+    sq_local_tail = sq_submitted = *sq_tail;
+    return setupBuffers();
+  }
+
+  // A field of the shared ring mapping, at an offset the kernel gave us.
+  template <typename T> T *at(uint32_t offset) {
+    return static_cast<T *>(
+        static_cast<void *>(static_cast<char *>(rings) + offset));
+  }
+
+  bool setupBuffers() {
+    buffer_ring = static_cast<io_uring_buf_ring *>(
+        mmap(nullptr, BUFFER_COUNT * sizeof(io_uring_buf),
+             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    buffers = static_cast<char *>(
+        mmap(nullptr, size_t{BUFFER_COUNT} * BUFFER_SIZE,
+             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (buffer_ring == MAP_FAILED || buffers == MAP_FAILED) {
+      return false;
+    }
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buffer_ring);
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg,
+                1) != 0) {
+      return false;
+    }
+    for (uint16_t id = 0; id < BUFFER_COUNT; ++id) {
+      provideBuffer(id);
+    }
+    return true;
+  }
+
+  char *buffer(uint16_t id) { return buffers + size_t{id} * BUFFER_SIZE; }
+
+  // Hands buffer id back to the kernel for future recvs.
+  void provideBuffer(uint16_t id) {
+    // Not buffer_ring->bufs: the header's flexible array member lands at
+    // offset 8 in C++, where the empty struct it is wrapped with takes space.
+    // Only the documented fields are set, since the tail overlays the first
+    // entry's resv.
+    auto *entries = static_cast<io_uring_buf *>(static_cast<void *>(buffer_ring));
+    auto &entry = entries[buffer_tail & (BUFFER_COUNT - 1)];
+    entry.addr = reinterpret_cast<uint64_t>(buffer(id));
+    entry.len = BUFFER_SIZE;
+    entry.bid = id;
+    ++buffer_tail;
+    std::atomic_ref<uint16_t>{buffer_ring->tail}.store(
+        buffer_tail, std::memory_order_release);
+  }
+
+  io_uring_sqe &nextSqe() {
+    if (sq_local_tail - std::atomic_ref<unsigned>{*sq_head}.load(
+                            std::memory_order_acquire) ==
+        sq_entries) {
+      enter(0);
+    }
+    auto index = sq_local_tail & sq_mask;
+    auto &sqe = sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sq_array[index] = index;
+    ++sq_local_tail;
+    return sqe;
+  }
+
+  // Submits everything queued and waits for at least min_complete
+  // completions.
+  void enter(unsigned min_complete) {
+    std::atomic_ref<unsigned>{*sq_tail}.store(sq_local_tail,
+                                              std::memory_order_release);
+    auto to_submit = sq_local_tail - sq_submitted;
+    auto submitted =
+        syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    if (submitted > 0) {
+      sq_submitted += static_cast<unsigned>(submitted);
+    } else if (submitted == -1 && errno != EINTR && errno != EAGAIN &&
+               errno != EBUSY) {
+      perror("io_uring_enter");
+      exit(1);
+    }
+  }
+
+  // Calls fn on every available completion.
+  template <typename Fn> void reap(Fn &&fn) {
+    auto head = *cq_head;
+    auto tail =
+        std::atomic_ref<unsigned>{*cq_tail}.load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      fn(cqes[head & cq_mask]);
+    }
+    std::atomic_ref<unsigned>{*cq_head}.store(head, std::memory_order_release);
+  }
+};
+
+// A connection's socket and the start of a command split across buffers.
+struct UringConnection {
+  int fd;
+  size_t partial = 0;
+  // Set once the input turned out malformed; the rest is dropped.
+  bool broken = false;
+  char pending[MAX_FRAME_BYTES];
+
+  explicit UringConnection(int _fd) : fd{_fd} {}
+};
+
+struct UringServer {
+  Engine &engine;
+  Ring ring;
+  int listenfd;
+  // Cleared when the kernel rejects the multishot variant (before 5.19 for
+  // accept, 6.0 for recv); the operation is then re-armed after every
+  // completion instead.
+  bool multishot_accept = true;
+  bool multishot_recv = true;
+
+  void armAccept() {
+    auto &sqe = ring.nextSqe();
+    sqe.opcode = IORING_OP_ACCEPT;
+    sqe.fd = listenfd;
+    sqe.ioprio = multishot_accept ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe.user_data = ACCEPT_TAG;
+  }
+
+  void armRecv(UringConnection *connection) {
+    auto &sqe = ring.nextSqe();
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = connection->fd;
+    sqe.ioprio = multishot_recv ? IORING_RECV_MULTISHOT : 0;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = BUFFER_GROUP;
+    sqe.user_data = reinterpret_cast<uint64_t>(connection);
+  }
+
+  void onAccept(const io_uring_cqe &cqe) {
+    if (cqe.res >= 0) {
+      armRecv(new UringConnection{cqe.res});
+    } else if (cqe.res == -EINVAL && multishot_accept) {
+      multishot_accept = false;
+    } else if (cqe.res != -ECONNABORTED && cqe.res != -EINTR) {
+      errno = -cqe.res;
+      perror("accept");
+      exit(1);
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      armAccept();
+    }
+  }
+
+  // Hands every complete frame or command in data to the engine, joining the
+  // first with the partial one left over from the previous buffer. Returns
+  // false if the input is malformed.
+  bool consume(UringConnection &connection, const char *data, size_t size) {
+    ClientCommand inputs[FrameHeader::MAX_COMMANDS];
+    size_t count;
+    if (connection.partial) {
+      auto take =
+          std::min(size, sizeof(connection.pending) - connection.partial);
+      memcpy(connection.pending + connection.partial, data, take);
+      auto used = decodeCommands(connection.pending, connection.partial + take,
+                                 inputs, std::size(inputs), count);
+      if (used == SIZE_MAX) {
+        return false;
+      }
+      if (!used) {
+        connection.partial += take;
+        return true;
+      }
+      engine.handleCommands(inputs, count);
+      // The partial unit was not complete on its own, so it ends in data;
+      // the rest is decoded in place.
+      data += used - connection.partial;
+      size -= used - connection.partial;
+      connection.partial = 0;
+    }
+    while (true) {
+      auto used = decodeCommands(data, size, inputs, std::size(inputs), count);
+      if (used == SIZE_MAX) {
+        return false;
+      }
+      if (!used) {
+        break;
+      }
+      engine.handleCommands(inputs, count);
+      data += used;
+      size -= used;
+    }
+    memcpy(connection.pending, data, size);
+    connection.partial = size;
+    return true;
+  }
+
+  void onRecv(UringConnection *connection, const io_uring_cqe &cqe) {
+    if (cqe.res > 0) {
+      auto id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+      if (!connection->broken &&
+          !consume(*connection, ring.buffer(id),
+                   static_cast<size_t>(cqe.res))) {
+        // Ends the recv with EOF, which closes the connection below.
+        connection->broken = true;
+        shutdown(connection->fd, SHUT_RD);
+      }
+      ring.provideBuffer(id);
+    }
+    if (cqe.flags & IORING_CQE_F_MORE) {
+      return;
+    }
+    if (cqe.res > 0 || cqe.res == -ENOBUFS) {
+      // Single-shot recv, or multishot stopped because every buffer was
+      // in use; the ones consumed above are back in the ring now.
+      armRecv(connection);
+      return;
+    }
+    if (cqe.res == -EINVAL && multishot_recv) {
+      multishot_recv = false;
+      armRecv(connection);
+      return;
+    }
+    if (cqe.res < 0 || connection->partial || connection->broken) {
+      SyncCerr{} << "Error reading input" << std::endl;
+    }
+    close(connection->fd);
+    delete connection;
+  }
+
+  [[noreturn]] void run() {
+    armAccept();
+    while (true) {
+      ring.enter(1);
+      ring.reap([&](const io_uring_cqe &cqe) {
+        if (cqe.user_data == ACCEPT_TAG) {
+          onAccept(cqe);
+        } else {
+          onRecv(reinterpret_cast<UringConnection *>(cqe.user_data), cqe);
+        }
+      });
+    }
+  }
+};
+
+} // namespace
+
+bool serveWithUring(Engine &engine, int listenfd) {
+  UringServer server{engine, {}, listenfd};
+  if (!server.ring.setup(256, 4096)) {
+    return false;
+  }
+  server.run();
+}
+
+#else
+
+bool serveWithUring(Engine &, int) { return false; }
+
+#endif
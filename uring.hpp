@@ -0,0 +1,17 @@
+#pragma once
+
+struct Engine;
+
+// Serves the listening socket and every client connection from a single
+// io_uring instance on the calling thread, as an alternative to blocking
+// accept() plus a thread (or reactor slot) per connection.
+//
+// Connections are accepted with a multishot accept and read with multishot
+// recv into a ring of buffers provided to the kernel up front. A busy stream
+// of commands therefore costs no syscall per read: the loop enters the kernel
+// once per batch of completions, and re-arms ride along with that call.
+//
+// Never returns once serving has started. Returns false, having accepted
+// nothing, when io_uring was not compiled in or the kernel can't set up what
+// this needs; the caller then falls back to its blocking accept() loop.
+bool serveWithUring(Engine &engine, int listenfd);